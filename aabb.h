@@ -19,6 +19,25 @@ public:
 	bool hitNormal(const ray& r, float tmin, float tmax) const;
 	bool hitImproved(const ray& r, float tmin, float tmax) const;
 
+	//Surface area of the box, used by the SAH in the BVH builder
+	float area() const
+	{
+		vec3 d = _max - _min;
+		return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+	}
+
+	//Index of the longest axis
+	int maximum_extent() const
+	{
+		vec3 d = _max - _min;
+		if (d.x() > d.y() && d.x() > d.z())
+			return 0;
+		else if (d.y() > d.z())
+			return 1;
+		else
+			return 2;
+	}
+
 	vec3 _min;
 	vec3 _max;
 };
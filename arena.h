@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//Bump allocator a scene lives in. Objects are placed one after another in
+//	large blocks, in the order they are created, so what is built together
+//	(a box's faces, a BVH's nodes in depth first order) sits together in
+//	memory. Nothing is freed on its own: clear() or the destructor runs
+//	every destructor in reverse order and frees all blocks at once.
+class arena
+{
+public:
+	arena(size_t block_bytes = 64 * 1024) : block_size(block_bytes), used(0) {}
+	~arena() { clear(); }
+	arena(const arena&) = delete;
+	arena& operator=(const arena&) = delete;
+
+	//Uninitialized memory for size bytes at align, a power of two
+	void *allocate(size_t size, size_t align)
+	{
+		if (!blocks.empty())
+		{
+			block& b = blocks.back();
+			uintptr_t p = (uintptr_t(b.data) + b.used + align - 1) & ~uintptr_t(align - 1);
+			size_t offset = p - uintptr_t(b.data);
+			if (offset + size <= b.size)
+			{
+				b.used = offset + size;
+				used += size;
+				return (void*)p;
+			}
+		}
+		//Oversized requests get a block of their own
+		block b;
+		b.size = std::max(block_size, size + align);
+		b.data = new char[b.size];
+		uintptr_t p = (uintptr_t(b.data) + align - 1) & ~uintptr_t(align - 1);
+		b.used = p - uintptr_t(b.data) + size;
+		blocks.push_back(b);
+		used += size;
+		return (void*)p;
+	}
+
+	//Constructs a T in the arena, destroyed by clear()
+	template<typename T, typename... Args>
+	T *create(Args&&... args)
+	{
+		T *object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		if (!std::is_trivially_destructible<T>::value)
+			destructors.push_back(destructor(object, [](void *p) { static_cast<T*>(p)->~T(); }));
+		return object;
+	}
+
+	//n value initialized elements of a trivially destructible T
+	template<typename T>
+	T *create_array(size_t n)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "array elements aren't destroyed");
+		T *array = (T*)allocate(sizeof(T) * std::max<size_t>(n, 1), alignof(T));
+		for (size_t i = 0; i < n; i++)
+			new (array + i) T();
+		return array;
+	}
+
+	void clear()
+	{
+		for (size_t i = destructors.size(); i-- > 0;)
+			destructors[i].second(destructors[i].first);
+		destructors.clear();
+		for (block& b : blocks)
+			delete[] b.data;
+		blocks.clear();
+		used = 0;
+	}
+
+	size_t bytes_used() const { return used; }
+	size_t bytes_reserved() const
+	{
+		size_t total = 0;
+		for (const block& b : blocks)
+			total += b.size;
+		return total;
+	}
+
+private:
+	struct block
+	{
+		char *data;
+		size_t size, used;
+	};
+	typedef std::pair<void*, void(*)(void*)> destructor;
+
+	size_t block_size;
+	size_t used;
+	std::vector<block> blocks;
+	std::vector<destructor> destructors;
+};
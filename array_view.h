@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+//Non-owning view of n contiguous T, for arrays that may live in a vector or
+//	in a memory mapped file. The memory must outlive the view.
+template<typename T>
+class array_view
+{
+public:
+	array_view() : ptr(NULL), n(0) {}
+	array_view(T *p, size_t count) : ptr(p), n(count) {}
+	template<typename U>
+	array_view(std::vector<U>& v) : ptr(v.data()), n(v.size()) {}
+
+	T& operator[](size_t i) const { return ptr[i]; }
+	T *data() const { return ptr; }
+	size_t size() const { return n; }
+	bool empty() const { return n == 0; }
+	T *begin() const { return ptr; }
+	T *end() const { return ptr + n; }
+
+private:
+	T *ptr;
+	size_t n;
+};
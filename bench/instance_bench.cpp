@@ -0,0 +1,154 @@
+//Instancing benchmark: one sphere mesh placed N_INSTANCES times, once as a
+//	single flat mesh holding a moved copy of every triangle and once as
+//	instances of the one mesh (with its own BVH) under a top level wide_bvh.
+//	Both trace with the same triangle kernel. Compares memory, build time
+//	and trace rate, checks both find the same hits, then moves every
+//	instance and times the top level rebuild.
+//
+//	g++ -std=c++17 -O2 [-mavx2] -I.. instance_bench.cpp -o instance_bench -lpthread
+
+#include <cfloat>
+#include "../triangle_mesh.h"
+#include "../instance.h"
+#include "../wide_bvh.h"
+#include <chrono>
+#include <cstdio>
+
+using namespace std;
+
+const int N_INSTANCES = 4000;
+const int MESH_RINGS = 10; //the mesh has 2 * MESH_RINGS * MESH_RINGS triangles
+const int N_RAYS = 200000;
+
+float frand() { return rand() / (RAND_MAX + 1.0f); }
+
+vec3 random_point() { return vec3(frand() * 1000, frand() * 1000, frand() * 1000); }
+
+//Somewhere in the field, turned about y by a random angle
+affine_transform random_placement()
+{
+	float radians = frand() * 2 * M_PI;
+	return affine_transform::translation(random_point()) * affine_transform::rotation(1, sin(radians), cos(radians));
+}
+
+//Unit sphere as rings of quads split into triangles
+void sphere_mesh(vector<vec3>& vertices, vector<uint32_t>& indices)
+{
+	for (int i = 0; i <= MESH_RINGS; i++)
+	{
+		float theta = M_PI * i / MESH_RINGS;
+		for (int j = 0; j <= MESH_RINGS; j++)
+		{
+			float phi = 2 * M_PI * j / MESH_RINGS;
+			vertices.push_back(vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi)) * 8);
+		}
+	}
+	for (int i = 0; i < MESH_RINGS; i++)
+	{
+		for (int j = 0; j < MESH_RINGS; j++)
+		{
+			uint32_t a = i * (MESH_RINGS + 1) + j, b = a + MESH_RINGS + 1;
+			uint32_t quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+}
+
+size_t bytes(const triangle_mesh& m)
+{
+	return m.vertices.size() * sizeof(vec3) + m.indices.size() * sizeof(uint32_t)
+		+ m.nodes.size() * sizeof(linear_bvh_node) + m.packets.size() * sizeof(triangle_packet);
+}
+
+//What a top level and its instances take, not counting what they place
+size_t bytes(const wide_bvh& w)
+{
+	return w.nodes.capacity() * sizeof(wide_bvh_node) + w.primitives.capacity() * sizeof(primitive_handle)
+		+ w.store.instances.capacity() * sizeof(instance);
+}
+
+template<typename F>
+double seconds(F f)
+{
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	f();
+	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+	return chrono::duration<double>(end - start).count();
+}
+
+//Closest hit of every ray, FLT_MAX for a miss
+vector<float> trace(const char *name, const hitable *world, const vector<ray>& rays)
+{
+	vector<float> t(rays.size(), FLT_MAX);
+	double s = seconds([&]()
+	{
+		hit_record rec;
+		for (size_t i = 0; i < rays.size(); i++)
+		{
+			if (world->hit(rays[i], 0.001f, FLT_MAX, rec))
+				t[i] = rec.t;
+		}
+	});
+	printf("%-12s trace   %8.2f M rays/s\n", name, rays.size() / s * 1e-6);
+	return t;
+}
+
+int main()
+{
+	srand(1);
+	vector<vec3> vertices;
+	vector<uint32_t> indices;
+	sphere_mesh(vertices, indices);
+	triangle_mesh *mesh = new triangle_mesh(vertices, indices, nullptr);
+
+	vector<affine_transform> placements;
+	for (int i = 0; i < N_INSTANCES; i++)
+		placements.push_back(random_placement());
+
+	//Flat: every copy's vertices moved into place
+	vector<vec3> copy_vertices;
+	vector<uint32_t> copy_indices;
+	for (const affine_transform& m : placements)
+	{
+		uint32_t first = uint32_t(copy_vertices.size());
+		for (const vec3& v : vertices)
+			copy_vertices.push_back(m.point(v));
+		for (uint32_t i : indices)
+			copy_indices.push_back(first + i);
+	}
+	triangle_mesh *flat = NULL;
+	double flat_build = seconds([&]() { flat = new triangle_mesh(copy_vertices, copy_indices, nullptr); });
+
+	//Two levels: the one mesh under N_INSTANCES transforms
+	vector<hitable*> instances;
+	for (const affine_transform& m : placements)
+		instances.push_back(new instance(mesh, m));
+	wide_bvh *top = NULL;
+	double top_build = seconds([&]() { top = new wide_bvh(instances.data(), int(instances.size())); });
+
+	printf("%d copies of a %d triangle mesh\n", N_INSTANCES, mesh->n_triangles());
+	printf("%-12s build   %8.2f ms  %8zu KB\n", "flat", flat_build * 1e3, bytes(*flat) / 1024);
+	printf("%-12s build   %8.2f ms  %8zu KB (mesh %zu KB)\n", "two level", top_build * 1e3, (bytes(*top) + bytes(*mesh)) / 1024, bytes(*mesh) / 1024);
+
+	vector<ray> rays;
+	for (int i = 0; i < N_RAYS; i++)
+		rays.push_back(ray(random_point(), unit_vector(random_point() - vec3(500, 500, 500))));
+	vector<float> a = trace("flat", flat, rays);
+	vector<float> b = trace("two level", top, rays);
+	int mismatches = 0;
+	for (size_t i = 0; i < rays.size(); i++)
+	{
+		if ((a[i] == FLT_MAX) != (b[i] == FLT_MAX) || (a[i] != FLT_MAX && fabs(a[i] - b[i]) > 1e-2f * max(1.0f, a[i])))
+			mismatches++;
+	}
+	printf("%d of %d rays disagree\n", mismatches, N_RAYS);
+
+	//Everything moves: the instances get new transforms, the top level is
+	//	rebuilt over them, the mesh is left alone
+	for (hitable *in : instances)
+		static_cast<instance*>(in)->place(random_placement());
+	double rebuild = seconds([&]() { top->rebuild(); });
+	printf("%-12s rebuild %8.2f ms after moving every instance\n", "two level", rebuild * 1e3);
+	trace("moved", top, rays);
+	return 0;
+}
@@ -0,0 +1,102 @@
+//Visibility benchmark: hitable::hit against hitable::occluded for shadow
+//	ray style queries between random point pairs inside a Cornell box
+//	filled with spheres, triangles and rotated boxes. Both queries must
+//	agree on every segment; occluded may stop at the first blocker.
+//
+//	g++ -std=c++17 -O2 [-mavx2] -I.. occlusion_bench.cpp -o occlusion_bench -lpthread
+
+#include <cfloat>
+#include "../sphere.h"
+#include "../rect.h"
+#include "../box.h"
+#include "../rotate.h"
+#include "../triangle.h"
+#include "../bvh.h"
+#include "../linear_bvh.h"
+#include "../wide_bvh.h"
+#include <chrono>
+#include <cstdio>
+
+using namespace std;
+
+const int N_SPHERES = 2000;
+const int N_TRIANGLES = 2000;
+const int N_BOXES = 50;
+const int N_SEGMENTS = 200000;
+
+float frand() { return rand() / (RAND_MAX + 1.0f); }
+
+vec3 random_point() { return vec3(frand() * 555, frand() * 555, frand() * 555); }
+
+template<typename F>
+int run(const char *name, F f)
+{
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	int blocked = f();
+	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+	double seconds = chrono::duration<double>(end - start).count();
+	printf("%-28s %8.2f M rays/s  %8d blocked\n", name, N_SEGMENTS / seconds * 1e-6, blocked);
+	return blocked;
+}
+
+void bench(const char *accel, hitable *world, const vector<ray>& segments)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "%s hit", accel);
+	int a = run(name, [&]()
+	{
+		int blocked = 0;
+		hit_record rec;
+		for (const ray& r : segments)
+			blocked += world->hit(r, 0.001f, 0.999f, rec);
+		return blocked;
+	});
+	snprintf(name, sizeof(name), "%s occluded", accel);
+	int b = run(name, [&]()
+	{
+		int blocked = 0;
+		for (const ray& r : segments)
+			blocked += world->occluded(r, 0.001f, 0.999f);
+		return blocked;
+	});
+	if (a != b)
+		printf("MISMATCH: %d vs %d\n", a, b);
+}
+
+int main()
+{
+	srand(1);
+	vector<hitable*> list;
+	list.push_back(new flip_normals(new yz_rect(0, 555, 0, 555, 555, nullptr)));
+	list.push_back(new yz_rect(0, 555, 0, 555, 0, nullptr));
+	list.push_back(new flip_normals(new xz_rect(0, 555, 0, 555, 555, nullptr)));
+	list.push_back(new xz_rect(0, 555, 0, 555, 0, nullptr));
+	list.push_back(new flip_normals(new xy_rect(0, 555, 0, 555, 555, nullptr)));
+	for (int i = 0; i < N_SPHERES; i++)
+		list.push_back(new sphere(random_point(), 2 + frand() * 6, nullptr));
+	for (int i = 0; i < N_TRIANGLES; i++)
+	{
+		vec3 c = random_point();
+		list.push_back(new triangle(c, c + vec3(frand() * 20, frand() * 20, frand() * 20), c + vec3(frand() * 20, frand() * 20, frand() * 20), nullptr));
+	}
+	for (int i = 0; i < N_BOXES; i++)
+	{
+		float s = 10 + frand() * 30;
+		list.push_back(new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(s, s, s), nullptr), frand() * 90), random_point()));
+	}
+
+	//Segments between two interior points, direction not normalised so the
+	//	far point sits at t = 1
+	vector<ray> segments;
+	for (int i = 0; i < N_SEGMENTS; i++)
+	{
+		vec3 a = random_point();
+		segments.push_back(ray(a, random_point() - a));
+	}
+
+	printf("%d primitives, %d segments\n", int(list.size()), N_SEGMENTS);
+	bench("bvh_node", new bvh_node(list.data(), int(list.size())), segments);
+	bench("linear_bvh", new linear_bvh(list.data(), int(list.size())), segments);
+	bench("wide_bvh", new wide_bvh(list.data(), int(list.size())), segments);
+	return 0;
+}
@@ -0,0 +1,101 @@
+//Microbenchmark of the ray-triangle kernels: triangle::MTAlgo,
+//	triangle::geometricSolution and the SoA packet kernel used in
+//	triangle_mesh leaves. Every ray is tested against every triangle, so the
+//	numbers are raw intersection throughput without any BVH.
+//
+//	g++ -std=c++17 -O2 [-mavx2] -I.. triangle_bench.cpp -o triangle_bench -lpthread
+
+#include "../triangle.h"
+#include "../triangle_mesh.h"
+#include <chrono>
+#include <cstdio>
+
+using namespace std;
+
+const int N_TRIANGLES = 4096;
+const int N_RAYS = 4096;
+
+float frand() { return rand() / (RAND_MAX + 1.0f); }
+
+template<typename F>
+void run(const char *name, int tests, F f)
+{
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	int hits = f();
+	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+	double seconds = chrono::duration<double>(end - start).count();
+	printf("%-28s %8.1f M tests/s  %8d hits\n", name, tests / seconds * 1e-6, hits);
+}
+
+int main()
+{
+	srand(1);
+	vector<triangle> tris;
+	vector<vec3> verts;
+	vector<uint32_t> indices;
+	for (int i = 0; i < N_TRIANGLES; i++)
+	{
+		vec3 c(frand() * 100, frand() * 100, frand() * 100);
+		vec3 p[3];
+		for (int k = 0; k < 3; k++)
+		{
+			p[k] = c + vec3(frand() * 10 - 5, frand() * 10 - 5, frand() * 10 - 5);
+			verts.push_back(p[k]);
+			indices.push_back(uint32_t(3 * i + k));
+		}
+		tris.push_back(triangle(p[0], p[1], p[2], nullptr));
+	}
+	triangle_mesh mesh(verts, indices, nullptr);
+
+	vector<ray> rays;
+	for (int i = 0; i < N_RAYS; i++)
+		rays.push_back(ray(vec3(frand() * 100, frand() * 100, -10), vec3(frand() - 0.5f, frand() - 0.5f, 1)));
+
+	int tests = N_TRIANGLES * N_RAYS;
+	printf("%d rays x %d triangles, packet width %d\n", N_RAYS, N_TRIANGLES, TRIANGLE_PACKET_WIDTH);
+
+	run("triangle::MTAlgo", tests, [&]()
+	{
+		int hits = 0;
+		hit_record rec;
+		for (const ray& r : rays)
+			for (const triangle& t : tris)
+				hits += t.MTAlgo(r, 0.001f, FLT_MAX, rec);
+		return hits;
+	});
+
+	run("triangle::geometricSolution", tests, [&]()
+	{
+		int hits = 0;
+		hit_record rec;
+		for (const ray& r : rays)
+			for (const triangle& t : tris)
+				hits += t.geometricSolution(r, 0.001f, FLT_MAX, rec);
+		return hits;
+	});
+
+	run("triangle_mesh scalar", tests, [&]()
+	{
+		int hits = 0;
+		float t;
+		for (const ray& r : rays)
+			for (int i = 0; i < mesh.n_triangles(); i++)
+				hits += mesh.intersect_triangle(i, r, 0.001f, FLT_MAX, t);
+		return hits;
+	});
+
+	//Only the closest lane is reported, so hits count packets rather than triangles
+	run("triangle_packet", tests, [&]()
+	{
+		int hits = 0;
+		float t;
+		for (const ray& r : rays)
+		{
+			packet_ray pr(r);
+			for (const triangle_packet& p : mesh.packets)
+				hits += intersect_triangle_packet(p, pr, 0.001f, FLT_MAX, t) >= 0;
+		}
+		return hits;
+	});
+	return 0;
+}
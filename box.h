@@ -1,17 +1,21 @@
 #pragma once
 
 #include "hitable.h"
-#include "hitablelist.h"
 #include "rect.h"
 
 //axis-aligned block primitive that holds 6 rectangles
 
+//The faces are members rather than a hitable_list of separately allocated
+//	rects and flip_normals wrappers: one object, no pointers to chase. Faces
+//	[1] sit on the max side, faces [0] on the min side with the normal flipped
+//	to point out of the box.
 class box : public hitable
 {
 public:
 	box() {}
 	box(const vec3& p0, const vec3 &p1, material *ptr);
 	virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t0, float t1) const;
 	virtual bool bounding_box(aabb& box) const
 	{
 		box = aabb(pmin, pmax);
@@ -19,24 +23,57 @@ public:
 	}
 
 	vec3 pmin, pmax;
-	hitable *list_ptr;
+	xy_rect xy[2];
+	xz_rect xz[2];
+	yz_rect yz[2];
 };
 
 box::box(const vec3& p0, const vec3& p1, material *ptr)
 {
 	pmin = p0;
 	pmax = p1;
-	hitable **list = new hitable*[6];
-	list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
-	list[1] = new flip_normals(new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
-	list[2] = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
-	list[3] = new flip_normals(new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
-	list[4] = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
-	list[5] = new flip_normals(new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
-	list_ptr = new hitable_list(list, 6);
+	xy[1] = xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
+	xy[0] = xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr);
+	xz[1] = xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
+	xz[0] = xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr);
+	yz[1] = yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
+	yz[0] = yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr);
+}
+
+//Closest hit on a pair of faces, flipping the normal of the min side one
+template<typename face>
+bool hit_faces(const face faces[2], const ray& r, float t0, float& t1, hit_record& rec)
+{
+	hit_record temp_rec;
+	bool hit_anything = false;
+	for (int i = 1; i >= 0; i--)
+	{
+		if (faces[i].hit(r, t0, t1, temp_rec))
+		{
+			hit_anything = true;
+			t1 = temp_rec.t;
+			rec = temp_rec;
+			if (i == 0)
+				rec.normal = -rec.normal;
+		}
+	}
+	return hit_anything;
 }
 
 bool box::hit(const ray& r, float t0, float t1, hit_record& rec) const
 {
-	return list_ptr->hit(r, t0, t1, rec);
-}
\ No newline at end of file
+	bool hit_xy = hit_faces(xy, r, t0, t1, rec);
+	bool hit_xz = hit_faces(xz, r, t0, t1, rec);
+	bool hit_yz = hit_faces(yz, r, t0, t1, rec);
+	return hit_xy || hit_xz || hit_yz;
+}
+
+bool box::occluded(const ray& r, float t0, float t1) const
+{
+	for (int i = 0; i < 2; i++)
+	{
+		if (xy[i].occluded(r, t0, t1) || xz[i].occluded(r, t0, t1) || yz[i].occluded(r, t0, t1))
+			return true;
+	}
+	return false;
+}
@@ -1,23 +1,118 @@
 #pragma once
 #include "hitable.h"
+#include "arena.h"
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <thread>
+#include <atomic>
 
-#define drand48() (rand() / (RAND_MAX + 1.0))
+//Build quality of the BVH
+//	BVH_FAST   - median split along the longest centroid axis
+//	BVH_MEDIUM - binned SAH with 12 bins along the longest centroid axis
+//	BVH_HIGH   - binned SAH with 32 bins along all three axes
+enum bvh_quality
+{
+	BVH_FAST,
+	BVH_MEDIUM,
+	BVH_HIGH
+};
+
+//Cost of one node traversal step relative to one primitive intersection
+const float BVH_TRAVERSAL_COST = 0.125f;
+const int BVH_MAX_BINS = 32;
+//Below this depth the builder only splits at the median. A range of n
+//	primitives then ends within log2(n) <= 31 more levels, so no leaf is
+//	deeper than 63 however lopsided the SAH splits above it were.
+const int BVH_SAH_MAX_DEPTH = 32;
+const int BVH_MAX_DEPTH = BVH_SAH_MAX_DEPTH + 31;
+
+//Bounds and centroid of every primitive are computed once up front, so the
+//	builder never calls the virtual bounding_box() while partitioning.
+struct bvh_primitive_info
+{
+	bvh_primitive_info() {}
+	bvh_primitive_info(int i, const aabb& b) : index(i), bounds(b), centroid(0.5f * (b.min() + b.max())) {}
+	int index;
+	aabb bounds;
+	vec3 centroid;
+};
+
+//Temporary tree produced by the builder. Leaves reference the range
+//	[first_prim_offset, first_prim_offset + n_primitives) of the ordered list.
+struct bvh_build_node
+{
+	void init_leaf(int first, int n, const aabb& b)
+	{
+		first_prim_offset = first;
+		n_primitives = n;
+		bounds = b;
+		children[0] = children[1] = nullptr;
+	}
+
+	void init_interior(int axis, bvh_build_node *c0, bvh_build_node *c1)
+	{
+		children[0] = c0;
+		children[1] = c1;
+		bounds = surrounding_box(c0->bounds, c1->bounds);
+		split_axis = axis;
+		n_primitives = 0;
+	}
+
+	aabb bounds;
+	bvh_build_node *children[2];
+	int split_axis, first_prim_offset, n_primitives;
+};
+
+//Subtrees smaller than this are always built on the calling thread
+const int BVH_PARALLEL_THRESHOLD = 4096;
+//Ranges at least this large are bounded and binned by several threads
+const int BVH_PARALLEL_BINNING_THRESHOLD = 65536;
+
+inline int bvh_build_threads()
+{
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//Number of tree levels that hand a subtree to a new thread, enough to give
+//	every hardware thread its own subtree.
+inline int bvh_spawn_depth()
+{
+	int depth = 0;
+	while ((1 << depth) < bvh_build_threads())
+		depth++;
+	return depth;
+}
 
-int box_x_compare(const void * a, const void * b);
-int box_y_compare(const void * a, const void * b);
-int box_z_compare(const void * a, const void * b);
+std::vector<bvh_primitive_info> bvh_compute_primitive_info(hitable **l, int n);
+//leaf_batch is how many primitives a leaf tests at the cost of one, e.g. the
+//	lanes of a SIMD triangle packet; it makes the SAH favour full leaves.
+bvh_build_node *bvh_build(std::vector<bvh_primitive_info>& info, int max_prims_in_node, bvh_quality quality, int& total_nodes, std::vector<int>& ordered, int leaf_batch = 1);
+void bvh_free_build_tree(bvh_build_node *node);
 
 class bvh_node :public hitable
 {
 public:
 	bvh_node() {}
-	bvh_node(hitable **l, int n);
+	//Inner nodes below this one go to memory if given, in depth first order
+	bvh_node(hitable **l, int n, bvh_quality quality = BVH_MEDIUM, arena *memory = NULL);
 	virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
 	virtual bool bounding_box(aabb& box) const;
+
+	//Expected cost of a random ray under the surface area heuristic
+	float sah_cost() const;
+
 	hitable *left;
 	hitable *right;
 	aabb box;
+	int axis; //split axis, decides which child is nearer to the ray
+
+private:
+	bvh_node(const bvh_build_node *node, hitable **l, const std::vector<int>& ordered, arena *memory) { init(node, l, ordered, memory); }
+	void init(const bvh_build_node *node, hitable **l, const std::vector<int>& ordered, arena *memory);
+	hitable *child(const bvh_build_node *node, hitable **l, const std::vector<int>& ordered, arena *memory);
 };
 
 bool bvh_node::bounding_box(aabb& b) const
@@ -28,107 +123,427 @@ bool bvh_node::bounding_box(aabb& b) const
 
 bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-	if (box.hit(r, t_min, t_max))
+	if (!box.hit(r, t_min, t_max))
+		return false;
+
+	//Visit the child on the near side of the split first and clip t_max to
+	//	its hit, so the far child is only searched for closer intersections.
+	hitable *first = left;
+	hitable *second = right;
+	if (r.direction()[axis] < 0.0f)
+		std::swap(first, second);
+
+	bool hit_first = first->hit(r, t_min, t_max, rec);
+	if (first == second)
+		return hit_first;
+	bool hit_second = second->hit(r, t_min, hit_first ? rec.t : t_max, rec);
+	return hit_first || hit_second;
+}
+
+bool bvh_node::occluded(const ray& r, float t_min, float t_max) const
+{
+	if (!box.hit(r, t_min, t_max))
+		return false;
+	if (left->occluded(r, t_min, t_max))
+		return true;
+	return left != right && right->occluded(r, t_min, t_max);
+}
+
+bvh_node::bvh_node(hitable **l, int n, bvh_quality quality, arena *memory)
+{
+	std::vector<bvh_primitive_info> info = bvh_compute_primitive_info(l, n);
+
+	int total_nodes = 0;
+	std::vector<int> ordered;
+	bvh_build_node *root = bvh_build(info, 1, quality, total_nodes, ordered);
+
+	if (root->n_primitives > 0)
+	{
+		left = right = l[ordered[root->first_prim_offset]];
+		box = root->bounds;
+		axis = 0;
+	}
+	else
+	{
+		init(root, l, ordered, memory);
+	}
+	bvh_free_build_tree(root);
+}
+
+void bvh_node::init(const bvh_build_node *node, hitable **l, const std::vector<int>& ordered, arena *memory)
+{
+	left = child(node->children[0], l, ordered, memory);
+	right = child(node->children[1], l, ordered, memory);
+	box = node->bounds;
+	axis = node->split_axis;
+}
+
+//The primitive of a leaf, or a new inner node. Nodes need no destructor, so
+//	the arena only has to place them.
+hitable *bvh_node::child(const bvh_build_node *node, hitable **l, const std::vector<int>& ordered, arena *memory)
+{
+	if (node->n_primitives > 0)
+		return l[ordered[node->first_prim_offset]];
+	if (memory)
+		return new (memory->allocate(sizeof(bvh_node), alignof(bvh_node))) bvh_node(node, l, ordered, memory);
+	return new bvh_node(node, l, ordered, memory);
+}
+
+float bvh_node::sah_cost() const
+{
+	float cost = BVH_TRAVERSAL_COST;
+	float inv_area = 1.0f / box.area();
+	hitable *children[2] = { left, right };
+	for (int i = 0; i < (left == right ? 1 : 2); i++)
+	{
+		aabb b;
+		children[i]->bounding_box(b);
+		const bvh_node *child = dynamic_cast<const bvh_node*>(children[i]);
+		cost += b.area() * inv_area * (child ? child->sah_cost() : 1.0f);
+	}
+	return cost;
+}
+
+//Runs f(chunk_begin, chunk_end, chunk) over n_chunks equal slices of [begin, end),
+//	each slice but the first on its own thread.
+template<typename F>
+void bvh_parallel_chunks(int begin, int end, int n_chunks, F f)
+{
+	long long size = end - begin;
+	std::vector<std::thread> threads;
+	for (int c = 1; c < n_chunks; c++)
+		threads.push_back(std::thread(f, begin + int(size * c / n_chunks), begin + int(size * (c + 1) / n_chunks), c));
+	f(begin, begin + int(size / n_chunks), 0);
+	for (auto &t : threads)
+		t.join();
+}
+
+std::vector<bvh_primitive_info> bvh_compute_primitive_info(hitable **l, int n)
+{
+	std::vector<bvh_primitive_info> info(n);
+	int n_chunks = n >= BVH_PARALLEL_BINNING_THRESHOLD ? bvh_build_threads() : 1;
+	bvh_parallel_chunks(0, n, n_chunks, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			aabb b;
+			if (!l[i]->bounding_box(b))
+				std::cerr << "no bounding box in bvh constructor\n";
+			info[i] = bvh_primitive_info(i, b);
+		}
+	});
+	return info;
+}
+
+struct bvh_bins
+{
+	int counts[BVH_MAX_BINS];
+	aabb bounds[BVH_MAX_BINS];
+};
+
+inline int bvh_bin_index(const bvh_primitive_info& pi, int axis, float cmin, float extent, int n_bins)
+{
+	int b = int(n_bins * (pi.centroid[axis] - cmin) / extent);
+	return b < n_bins ? b : n_bins - 1;
+}
+
+//Bins the centroids of [start, end) along axis, splitting the range across
+//	n_chunks threads that each fill their own bins before they are merged.
+void bvh_bin_centroids(const std::vector<bvh_primitive_info>& info, int start, int end, int axis, float cmin, float extent, int n_bins, int n_chunks, bvh_bins& bins)
+{
+	if (n_chunks == 1)
 	{
-		hit_record left_rec, right_rec;
-		bool hit_left = left->hit(r, t_min, t_max, left_rec);
-		bool hit_right = right->hit(r, t_min, t_max, right_rec);
-		if (hit_left && hit_right)
+		for (int b = 0; b < n_bins; b++)
+			bins.counts[b] = 0;
+		for (int i = start; i < end; i++)
 		{
-			if (left_rec.t < right_rec.t)
-				rec = left_rec;
-			else
-				rec = right_rec;
-			return true;
+			int b = bvh_bin_index(info[i], axis, cmin, extent, n_bins);
+			bins.bounds[b] = bins.counts[b] == 0 ? info[i].bounds : surrounding_box(bins.bounds[b], info[i].bounds);
+			bins.counts[b]++;
 		}
-		else if (hit_left)
+		return;
+	}
+
+	std::vector<bvh_bins> partial(n_chunks);
+	bvh_parallel_chunks(start, end, n_chunks, [&](int begin, int last, int c)
+	{
+		bvh_bins& local = partial[c];
+		for (int b = 0; b < n_bins; b++)
+			local.counts[b] = 0;
+		for (int i = begin; i < last; i++)
 		{
-			rec = left_rec;
-			return true;
+			int b = bvh_bin_index(info[i], axis, cmin, extent, n_bins);
+			local.bounds[b] = local.counts[b] == 0 ? info[i].bounds : surrounding_box(local.bounds[b], info[i].bounds);
+			local.counts[b]++;
 		}
-		else if (hit_right)
+	});
+
+	bins = partial[0];
+	for (int c = 1; c < n_chunks; c++)
+	{
+		for (int b = 0; b < n_bins; b++)
 		{
-			rec = right_rec;
-			return true;
+			if (partial[c].counts[b] == 0)
+				continue;
+			bins.bounds[b] = bins.counts[b] == 0 ? partial[c].bounds[b] : surrounding_box(bins.bounds[b], partial[c].bounds[b]);
+			bins.counts[b] += partial[c].counts[b];
 		}
-		else
-			return false;
 	}
-	else
-		return false;
 }
 
-bvh_node::bvh_node(hitable **l, int n)
+//Binned SAH: centroids are dropped into equally sized bins along an axis and
+//	the split between two neighbouring bins with the lowest
+//	C = C_trav + (A_left * N_left + A_right * N_right) / A_parent is chosen.
+//	Returns false when no split beats making a leaf (or none exists).
+bool bvh_find_sah_split(const std::vector<bvh_primitive_info>& info, int start, int end, const aabb& bounds, const aabb& centroid_bounds, int max_prims_in_node, int leaf_batch, bvh_quality quality, int n_chunks, int& split_axis, int& split_bin, int& n_bins)
 {
-	int axis = int(3 * drand48());
-	if (axis == 0)
-		qsort(l, n, sizeof(hitable *), box_x_compare);
-	else if (axis == 1)
-		qsort(l, n, sizeof(hitable *), box_y_compare);
-	else
-		qsort(l, n, sizeof(hitable *), box_z_compare);
+	n_bins = quality == BVH_HIGH ? 32 : 12;
+	int n = end - start;
+	float best_cost = FLT_MAX;
+	split_axis = -1;
 
-	if (n == 1)
+	int first_axis = quality == BVH_HIGH ? 0 : centroid_bounds.maximum_extent();
+	int last_axis = quality == BVH_HIGH ? 2 : first_axis;
+	for (int axis = first_axis; axis <= last_axis; axis++)
 	{
-		left = right = l[0];
+		float cmin = centroid_bounds.min()[axis];
+		float extent = centroid_bounds.max()[axis] - cmin;
+		if (extent <= 0.0f)
+			continue;
+
+		bvh_bins bins;
+		bvh_bin_centroids(info, start, end, axis, cmin, extent, n_bins, n_chunks, bins);
+
+		//Sweep from the right to get the area and count of every right side
+		float right_area[BVH_MAX_BINS];
+		int right_count[BVH_MAX_BINS];
+		aabb acc;
+		int count = 0;
+		for (int b = n_bins - 1; b > 0; b--)
+		{
+			if (bins.counts[b] > 0)
+				acc = count == 0 ? bins.bounds[b] : surrounding_box(acc, bins.bounds[b]);
+			count += bins.counts[b];
+			right_count[b] = count;
+			right_area[b] = count > 0 ? acc.area() : 0.0f;
+		}
+
+		count = 0;
+		for (int b = 0; b < n_bins - 1; b++)
+		{
+			if (bins.counts[b] > 0)
+				acc = count == 0 ? bins.bounds[b] : surrounding_box(acc, bins.bounds[b]);
+			count += bins.counts[b];
+			if (count == 0 || right_count[b + 1] == 0)
+				continue;
+			float cost = count * acc.area() + right_count[b + 1] * right_area[b + 1];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				split_axis = axis;
+				split_bin = b;
+			}
+		}
 	}
-	else if (n == 2)
+
+	if (split_axis < 0)
+		return false;
+
+	best_cost = BVH_TRAVERSAL_COST + best_cost / bounds.area();
+	float leaf_cost = float((n + leaf_batch - 1) / leaf_batch);
+	return n > max_prims_in_node || best_cost < leaf_cost;
+}
+
+//Bounds and centroid bounds of [start, end), over n_chunks threads
+void bvh_range_bounds(const std::vector<bvh_primitive_info>& info, int start, int end, int n_chunks, aabb& bounds, aabb& centroid_bounds)
+{
+	auto range = [&](int begin, int last, aabb& b, aabb& cb)
 	{
-		left = l[0];
-		right = l[1];
+		b = info[begin].bounds;
+		cb = aabb(info[begin].centroid, info[begin].centroid);
+		for (int i = begin + 1; i < last; i++)
+		{
+			b = surrounding_box(b, info[i].bounds);
+			cb = surrounding_box(cb, aabb(info[i].centroid, info[i].centroid));
+		}
+	};
+	if (n_chunks == 1)
+	{
+		range(start, end, bounds, centroid_bounds);
+		return;
 	}
-	else
+
+	std::vector<aabb> partial(2 * n_chunks);
+	bvh_parallel_chunks(start, end, n_chunks, [&](int begin, int last, int c) { range(begin, last, partial[2 * c], partial[2 * c + 1]); });
+	bounds = partial[0];
+	centroid_bounds = partial[1];
+	for (int c = 1; c < n_chunks; c++)
 	{
-		left = new bvh_node(l, n / 2);
-		right = new bvh_node(l + n / 2, n - n / 2);
+		bounds = surrounding_box(bounds, partial[2 * c]);
+		centroid_bounds = surrounding_box(centroid_bounds, partial[2 * c + 1]);
 	}
-	aabb box_left, box_right;
-	if (!left->bounding_box(box_left) || !right->bounding_box(box_right))
-		std::cerr << "no bounding box in bvh_constructor\n";
-	box = surrounding_box(box_left, box_right);
 }
 
-int box_x_compare(const void * a, const void * b)
+//Moves the elements of [start, end) that satisfy left in front of the
+//	others and returns where the others begin. With several chunks every
+//	thread counts its slice's left side, the counts tell each slice where
+//	its elements go, and they are scattered into a copy and moved back, in
+//	their order, which makes it a stable partition.
+template<typename P>
+int bvh_partition(std::vector<bvh_primitive_info>& info, int start, int end, int n_chunks, P left)
 {
-	aabb box_left, box_right;
-	hitable *ah = *(hitable**)a;
-	hitable *bh = *(hitable**)b;
-	if (!ah->bounding_box(box_left) || !bh->bounding_box(box_right))
+	if (n_chunks == 1)
+		return int(std::partition(info.begin() + start, info.begin() + end, left) - info.begin());
+
+	std::vector<int> left_count(n_chunks), right_count(n_chunks);
+	bvh_parallel_chunks(start, end, n_chunks, [&](int begin, int last, int c)
 	{
-		std::cerr << "no bounding box in bvh_node constructor\n";
+		int count = 0;
+		for (int i = begin; i < last; i++)
+			count += left(info[i]);
+		left_count[c] = count;
+		right_count[c] = last - begin - count;
+	});
+	int n_left = 0;
+	for (int c = 0; c < n_chunks; c++)
+		n_left += left_count[c];
+	std::vector<int> left_at(n_chunks), right_at(n_chunks);
+	for (int c = 0, l = 0, r = n_left; c < n_chunks; c++)
+	{
+		left_at[c] = l;
+		right_at[c] = r;
+		l += left_count[c];
+		r += right_count[c];
 	}
-	if (box_left.min().x() - box_right.min().x() < 0.0)
-		return -1;
-	else
-		return 1;
+
+	std::vector<bvh_primitive_info> scratch(end - start);
+	bvh_parallel_chunks(start, end, n_chunks, [&](int begin, int last, int c)
+	{
+		int l = left_at[c], r = right_at[c];
+		for (int i = begin; i < last; i++)
+			scratch[left(info[i]) ? l++ : r++] = info[i];
+	});
+	bvh_parallel_chunks(start, end, n_chunks, [&](int begin, int last, int)
+	{
+		std::copy(scratch.begin() + (begin - start), scratch.begin() + (last - start), info.begin() + begin);
+	});
+	return start + n_left;
 }
 
-int box_y_compare(const void * a, const void * b)
+//Median split of BVH_FAST. The top levels split at the bin holding the
+//	median instead, so they can bin and partition in parallel; nth_element
+//	would be one thread's O(n) pass over the largest ranges.
+int bvh_median_split(std::vector<bvh_primitive_info>& info, int start, int end, int axis, const aabb& centroid_bounds, int n_chunks)
 {
-	aabb box_left, box_right;
-	hitable *ah = *(hitable**)a;
-	hitable *bh = *(hitable**)b;
-	if (!ah->bounding_box(box_left) || !bh->bounding_box(box_right))
+	int mid = (start + end) / 2;
+	float cmin = centroid_bounds.min()[axis];
+	float extent = centroid_bounds.max()[axis] - cmin;
+	if (n_chunks > 1 && extent > 0.0f)
 	{
-		std::cerr << "no bounding box in bvh_node constructor\n";
+		bvh_bins bins;
+		bvh_bin_centroids(info, start, end, axis, cmin, extent, BVH_MAX_BINS, n_chunks, bins);
+		int split_bin = 0;
+		for (int count = bins.counts[0]; count < (end - start) / 2 && split_bin < BVH_MAX_BINS - 2; count += bins.counts[++split_bin])
+			;
+		int split = bvh_partition(info, start, end, n_chunks,
+			[=](const bvh_primitive_info& pi) { return bvh_bin_index(pi, axis, cmin, extent, BVH_MAX_BINS) <= split_bin; });
+		if (split > start && split < end)
+			return split;
 	}
-	if (box_left.min().y() - box_right.min().y() < 0.0)
-		return -1;
-	else
-		return 1;
+	std::nth_element(info.begin() + start, info.begin() + mid, info.begin() + end,
+		[axis](const bvh_primitive_info& a, const bvh_primitive_info& b) { return a.centroid[axis] < b.centroid[axis]; });
+	return mid;
 }
 
-int box_z_compare(const void * a, const void * b)
+//Subtrees of the top spawn_depth levels are handed to their own thread and
+//	the big ranges there are also bounded, binned and partitioned by several
+//	threads. Leaves reference their range of info directly. Each call
+//	counts the nodes of its subtree in n_nodes, the counts are added up on
+//	the way back rather than in one counter every thread writes.
+bvh_build_node *bvh_recursive_build(std::vector<bvh_primitive_info>& info, int start, int end, int max_prims_in_node, int leaf_batch, bvh_quality quality, int spawn_depth, int depth, int& n_nodes)
 {
-	aabb box_left, box_right;
-	hitable *ah = *(hitable**)a;
-	hitable *bh = *(hitable**)b;
-	if (!ah->bounding_box(box_left) || !bh->bounding_box(box_right))
+	bvh_build_node *node = new bvh_build_node;
+	n_nodes = 1;
+
+	int n = end - start;
+	int n_chunks = 1;
+	if (spawn_depth > 0 && n >= BVH_PARALLEL_BINNING_THRESHOLD)
+		n_chunks = std::max(1, bvh_build_threads() >> (bvh_spawn_depth() - spawn_depth));
+
+	aabb bounds, centroid_bounds;
+	bvh_range_bounds(info, start, end, n_chunks, bounds, centroid_bounds);
+
+	bool median = quality == BVH_FAST || depth >= BVH_SAH_MAX_DEPTH;
+	if (n <= max_prims_in_node && (n == 1 || median))
 	{
-		std::cerr << "no bounding box in bvh_node constructor\n";
+		node->init_leaf(start, n, bounds);
+		return node;
+	}
+
+	int axis = centroid_bounds.maximum_extent();
+	int mid;
+	if (!median)
+	{
+		int split_axis, split_bin, n_bins;
+		if (bvh_find_sah_split(info, start, end, bounds, centroid_bounds, max_prims_in_node, leaf_batch, quality, n_chunks, split_axis, split_bin, n_bins))
+		{
+			float cmin = centroid_bounds.min()[split_axis];
+			float extent = centroid_bounds.max()[split_axis] - cmin;
+			axis = split_axis;
+			mid = bvh_partition(info, start, end, n_chunks,
+				[=](const bvh_primitive_info& pi) { return bvh_bin_index(pi, split_axis, cmin, extent, n_bins) <= split_bin; });
+		}
+		else if (n <= max_prims_in_node)
+		{
+			node->init_leaf(start, n, bounds);
+			return node;
+		}
+		else
+		{
+			//All centroids coincide, fall back to the median split
+			mid = bvh_median_split(info, start, end, axis, centroid_bounds, 1);
+		}
 	}
-	if (box_left.min().z() - box_right.min().z() < 0.0)
-		return -1;
 	else
-		return 1;
-}
\ No newline at end of file
+		mid = bvh_median_split(info, start, end, axis, centroid_bounds, n_chunks);
+
+	bvh_build_node *children[2];
+	int child_nodes[2];
+	if (spawn_depth > 0 && n >= BVH_PARALLEL_THRESHOLD)
+	{
+		std::thread left_thread([&]() { children[0] = bvh_recursive_build(info, start, mid, max_prims_in_node, leaf_batch, quality, spawn_depth - 1, depth + 1, child_nodes[0]); });
+		children[1] = bvh_recursive_build(info, mid, end, max_prims_in_node, leaf_batch, quality, spawn_depth - 1, depth + 1, child_nodes[1]);
+		left_thread.join();
+	}
+	else
+	{
+		children[0] = bvh_recursive_build(info, start, mid, max_prims_in_node, leaf_batch, quality, 0, depth + 1, child_nodes[0]);
+		children[1] = bvh_recursive_build(info, mid, end, max_prims_in_node, leaf_batch, quality, 0, depth + 1, child_nodes[1]);
+	}
+	n_nodes += child_nodes[0] + child_nodes[1];
+	node->init_interior(axis, children[0], children[1]);
+	return node;
+}
+
+//Builds the tree over info using all hardware threads. Afterwards info is
+//	reordered so that every leaf covers a contiguous range of it, and
+//	ordered[i] holds the original index of the i-th primitive in leaf order.
+bvh_build_node *bvh_build(std::vector<bvh_primitive_info>& info, int max_prims_in_node, bvh_quality quality, int& total_nodes, std::vector<int>& ordered, int leaf_batch)
+{
+	bvh_build_node *root = bvh_recursive_build(info, 0, int(info.size()), max_prims_in_node, leaf_batch, quality, bvh_spawn_depth(), 0, total_nodes);
+
+	ordered.resize(info.size());
+	for (size_t i = 0; i < info.size(); i++)
+		ordered[i] = info[i].index;
+	return root;
+}
+
+void bvh_free_build_tree(bvh_build_node *node)
+{
+	if (node->n_primitives == 0)
+	{
+		bvh_free_build_tree(node->children[0]);
+		bvh_free_build_tree(node->children[1]);
+	}
+	delete node;
+}
@@ -3,15 +3,14 @@
 #include "ray.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
-
-#define drand48() (rand() / (RAND_MAX + 1.0))
+#include "sampler.h"
 
 vec3 random_in_unit_disk()
 {
 	vec3 p;
 	do
 	{
-		p = 2.0 * vec3(drand48(), drand48(), 0) - vec3(1, 1, 0);
+		p = 2.0 * vec3(random_float(), random_float(), 0) - vec3(1, 1, 0);
 	} while (dot(p, p) >= 1.0);
 	return p;
 }
@@ -19,6 +18,7 @@ vec3 random_in_unit_disk()
 class camera
 {
 public:
+	camera() {}
 	camera(vec3 lookfrom, vec3 lookat, vec3 vup, float vfov, float aspect, float aperture, float focus_dist) //vfov is top to bottom in degrees
 	{
 		lens_radius = aperture / 2;
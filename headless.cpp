@@ -0,0 +1,43 @@
+//Command line front end: renders with every thread and writes the image,
+//	no window and no SFML. Builds on any C++17 compiler, see the README.
+#include "renderer.h"
+
+int main(int argc, char **argv)
+{
+	if (!parse_options(argc, argv, options) || !render_setup())
+		return 1;
+
+	//The main thread renders tiles like every worker
+	const uint n_threads = options.threads - 1;
+	cout << "Launching " << 1 << " main thread + " << n_threads << " worker threads" << endl;
+	vector<thread> threads(n_threads);
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+	vector<Task> tasks(n_threads + 1);
+
+	int i = 1;
+	for (auto &t : threads)
+	{
+		t = thread(&Task::run, &tasks[i]);
+		i++;
+	}
+	tasks[0].run();
+
+	for (auto &t : threads)
+		t.join();
+
+	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+	cout << "Finished rendering in " << chrono::duration<double>(end - start).count() << "s" << endl;
+	cout << "Average samples per pixel: " << double(renderImage.totalSamples()) / (options.width * options.height) << endl;
+
+	cout << "Saving Image" << endl;
+	chrono::high_resolution_clock::time_point save_start = chrono::high_resolution_clock::now();
+	if (!write_image(options.output, renderImage.resolve()))
+	{
+		cerr << "Couldn't write " << options.output << endl;
+		return 1;
+	}
+	chrono::high_resolution_clock::time_point save_end = chrono::high_resolution_clock::now();
+	cout << "Image Saved to " << options.output << " in " << chrono::duration_cast<chrono::milliseconds>(save_end - save_start).count() << "ms" << endl;
+	return 0;
+}
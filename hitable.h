@@ -5,6 +5,8 @@
 
 #include "ray.h"
 #include "aabb.h"
+#include "sampler.h"
+#include <cfloat>
 
 class material;
 
@@ -21,8 +23,35 @@ class hitable
 public:
 	virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const = 0;
 	virtual bool bounding_box(aabb& box) const = 0;
+
+	//Any-hit query for shadow and visibility rays: true as soon as anything
+	//	is found in (t_min, t_max), without looking for the closest hit or
+	//	filling a hit_record.
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		hit_record rec;
+		return hit(r, t_min, t_max, rec);
+	}
+
+	//Light sampling, only needed for objects that are used as lights.
+	//	pdf_value is the density, per unit solid angle seen from o, of the
+	//	direction v reaching this object; random returns a direction from o
+	//	to a random point on it, not normalised.
+	virtual float pdf_value(const vec3& /*o*/, const vec3& /*v*/) const { return 0.0f; }
+	virtual vec3 random(const vec3& /*o*/) const { return vec3(1, 0, 0); }
 };
 
+//Converts uniform area sampling of a surface hit at rec along v into a
+//	solid angle density. Emitters are two-sided, so the cosine is unsigned.
+inline float area_to_solid_angle_pdf(const hit_record& rec, const vec3& v, float area)
+{
+	float distance_squared = rec.t * rec.t * v.squared_length();
+	float cosine = fabs(dot(v, rec.normal)) / v.length();
+	if (cosine <= 0.0f)
+		return 0.0f;
+	return distance_squared / (cosine * area);
+}
+
 //We added an emitted function. Like the background, it just tells the ray
 //	what color it is and performs no reflection.
 
@@ -46,6 +75,14 @@ public:
 		return ptr->bounding_box(box);
 	}
 
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return ptr->occluded(r, t_min, t_max);
+	}
+
+	virtual float pdf_value(const vec3& o, const vec3& v) const { return ptr->pdf_value(o, v); }
+	virtual vec3 random(const vec3& o) const { return ptr->random(o); }
+
 	hitable *ptr;
 };
 
@@ -61,6 +98,12 @@ public:
 	translate(hitable *p, const vec3& displacement) : ptr(p), offset(displacement) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
 	virtual bool bounding_box(aabb& box) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return ptr->occluded(ray(r.origin() - offset, r.direction()), t_min, t_max);
+	}
+	virtual float pdf_value(const vec3& o, const vec3& v) const { return ptr->pdf_value(o - offset, v); }
+	virtual vec3 random(const vec3& o) const { return ptr->random(o - offset); }
 	hitable *ptr;
 	vec3 offset;
 };
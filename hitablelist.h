@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hitable.h"
+#include <algorithm>
 
 class hitable_list : public hitable
 {
@@ -9,6 +10,9 @@ public:
 	hitable_list(hitable **l, int n) { list = l; list_size = n; }
 	virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
 	virtual bool bounding_box(aabb& box) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual float pdf_value(const vec3& o, const vec3& v) const;
+	virtual vec3 random(const vec3& o) const;
 	hitable **list;
 	int list_size;
 };
@@ -30,6 +34,16 @@ bool hitable_list::hit(const ray &r, float t_min, float t_max, hit_record &rec)
 	return hit_anything;
 }
 
+bool hitable_list::occluded(const ray& r, float t_min, float t_max) const
+{
+	for (int i = 0; i < list_size; i++)
+	{
+		if (list[i]->occluded(r, t_min, t_max))
+			return true;
+	}
+	return false;
+}
+
 bool hitable_list::bounding_box(aabb& box) const
 {
 	if (list_size < 1) return false;
@@ -49,4 +63,19 @@ bool hitable_list::bounding_box(aabb& box) const
 			return false;
 	}
 	return true;
+}
+
+//Picks one of the objects uniformly, so the density is their average
+float hitable_list::pdf_value(const vec3& o, const vec3& v) const
+{
+	float sum = 0.0f;
+	for (int i = 0; i < list_size; i++)
+		sum += list[i]->pdf_value(o, v);
+	return sum / list_size;
+}
+
+vec3 hitable_list::random(const vec3& o) const
+{
+	int index = std::min(int(random_float() * list_size), list_size - 1);
+	return list[index]->random(o);
 }
\ No newline at end of file
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include "simd.h"
+
+//Linear RGB float image, top row first. What the writers below take.
+struct image_buffer
+{
+	image_buffer() : width(0), height(0) {}
+	image_buffer(int w, int h) : width(w), height(h), rgb(size_t(w) * h * 3, 0.0f) {}
+
+	int width, height;
+	std::vector<float> rgb;
+};
+
+//Every writer converts the whole frame into one memory buffer and hands it
+//	to the stream with a single write, so saving costs one pass over the
+//	pixels and no per-pixel formatting or flushing. Float formats are written
+//	little endian, as on every platform the renderer targets.
+
+//Display value of a linear channel: gamma 2, clamped to [0, 255]
+inline uint8_t to_byte(float linear)
+{
+	float v = 255.99f * sqrtf(std::max(linear, 0.0f));
+	return uint8_t(std::min(v, 255.0f));
+}
+
+inline bool write_file(const std::string& path, const std::vector<uint8_t>& bytes)
+{
+	std::ofstream fout(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!fout)
+		return false;
+	fout.write((const char*)bytes.data(), bytes.size());
+	return bool(fout);
+}
+
+inline void append(std::vector<uint8_t>& out, const void *p, size_t n)
+{
+	out.insert(out.end(), (const uint8_t*)p, (const uint8_t*)p + n);
+}
+
+inline void append(std::vector<uint8_t>& out, const std::string& s)
+{
+	append(out, s.data(), s.size());
+}
+
+inline void append_be32(std::vector<uint8_t>& out, uint32_t v)
+{
+	uint8_t b[4] = { uint8_t(v >> 24), uint8_t(v >> 16), uint8_t(v >> 8), uint8_t(v) };
+	append(out, b, 4);
+}
+
+//RGBA display pixels of n pixels given as planar channel sums r, g, b and
+//	their sample counts: the mean, then to_byte(), SIMD_WIDTH pixels a step
+inline void tonemap_rgba(const float *r, const float *g, const float *b, const unsigned int *counts, int n, uint8_t *rgba)
+{
+	const vfloat zero = vset1(0.0f), one = vset1(1.0f), scale = vset1(255.99f), top = vset1(255.0f);
+	int i = 0;
+	for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+	{
+		vfloat inv_n = vdiv(one, vmax(vload_uint(counts + i), one));
+		vfloat vr = vmin(vmul(vsqrt(vmax(vmul(vloadu(r + i), inv_n), zero)), scale), top);
+		vfloat vg = vmin(vmul(vsqrt(vmax(vmul(vloadu(g + i), inv_n), zero)), scale), top);
+		vfloat vb = vmin(vmul(vsqrt(vmax(vmul(vloadu(b + i), inv_n), zero)), scale), top);
+		vstore_rgba8(rgba + i * 4, vr, vg, vb);
+	}
+	for (; i < n; i++)
+	{
+		float inv_n = 1.0f / std::max(counts[i], 1u);
+		uint8_t *p = rgba + i * 4;
+		p[0] = to_byte(r[i] * inv_n);
+		p[1] = to_byte(g[i] * inv_n);
+		p[2] = to_byte(b[i] * inv_n);
+		p[3] = 255;
+	}
+}
+
+//8-bit gamma corrected RGB, top row first
+inline std::vector<uint8_t> to_rgb8(const image_buffer& img)
+{
+	std::vector<uint8_t> rgb8(img.rgb.size());
+	for (size_t i = 0; i < img.rgb.size(); i++)
+		rgb8[i] = to_byte(img.rgb[i]);
+	return rgb8;
+}
+
+//Binary PPM (P6)
+inline bool write_ppm(const std::string& path, const image_buffer& img)
+{
+	std::vector<uint8_t> out;
+	append(out, "P6\n" + std::to_string(img.width) + " " + std::to_string(img.height) + "\n255\n");
+	std::vector<uint8_t> rgb8 = to_rgb8(img);
+	append(out, rgb8.data(), rgb8.size());
+	return write_file(path, out);
+}
+
+struct crc32_table
+{
+	crc32_table()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			entry[i] = c;
+		}
+	}
+
+	uint32_t entry[256];
+};
+
+inline uint32_t crc32(const uint8_t *p, size_t n)
+{
+	static const crc32_table table;
+	uint32_t crc = 0xffffffffu;
+	for (size_t i = 0; i < n; i++)
+		crc = table.entry[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+inline void append_png_chunk(std::vector<uint8_t>& out, const char *type, const std::vector<uint8_t>& data)
+{
+	append_be32(out, uint32_t(data.size()));
+	size_t start = out.size();
+	append(out, type, 4);
+	append(out, data.data(), data.size());
+	append_be32(out, crc32(&out[start], out.size() - start));
+}
+
+//8-bit RGB PNG. The zlib stream uses stored (uncompressed) deflate blocks:
+//	no compressor to depend on and as fast as a copy, at the size of a PPM.
+inline bool write_png(const std::string& path, const image_buffer& img)
+{
+	//Filter type 0 (none) in front of every row
+	std::vector<uint8_t> rgb8 = to_rgb8(img);
+	size_t row = size_t(img.width) * 3;
+	std::vector<uint8_t> raw;
+	raw.reserve((row + 1) * img.height);
+	for (int y = 0; y < img.height; y++)
+	{
+		raw.push_back(0);
+		append(raw, &rgb8[y * row], row);
+	}
+
+	std::vector<uint8_t> z;
+	z.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	z.push_back(0x78); //deflate, 32K window
+	z.push_back(0x01);
+	size_t pos = 0;
+	do
+	{
+		uint16_t len = uint16_t(std::min<size_t>(raw.size() - pos, 65535));
+		uint16_t nlen = uint16_t(~len);
+		z.push_back(pos + len == raw.size() ? 1 : 0); //BFINAL, BTYPE 00
+		uint8_t lens[4] = { uint8_t(len), uint8_t(len >> 8), uint8_t(nlen), uint8_t(nlen >> 8) };
+		append(z, lens, 4);
+		append(z, raw.data() + pos, len);
+		pos += len;
+	} while (pos < raw.size());
+	uint32_t a = 1, b = 0; //Adler-32 of the uncompressed data
+	for (size_t i = 0; i < raw.size(); i++)
+	{
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	append_be32(z, (b << 16) | a);
+
+	std::vector<uint8_t> ihdr;
+	append_be32(ihdr, img.width);
+	append_be32(ihdr, img.height);
+	uint8_t format[5] = { 8, 2, 0, 0, 0 }; //8 bits, RGB, deflate, no filter, no interlace
+	append(ihdr, format, 5);
+
+	std::vector<uint8_t> out;
+	const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	append(out, signature, 8);
+	append_png_chunk(out, "IHDR", ihdr);
+	append_png_chunk(out, "IDAT", z);
+	append_png_chunk(out, "IEND", std::vector<uint8_t>());
+	return write_file(path, out);
+}
+
+//Linear float PFM. Rows go bottom to top, the negative scale marks little endian.
+inline bool write_pfm(const std::string& path, const image_buffer& img)
+{
+	std::vector<uint8_t> out;
+	append(out, "PF\n" + std::to_string(img.width) + " " + std::to_string(img.height) + "\n-1.0\n");
+	size_t row = size_t(img.width) * 3;
+	for (int y = img.height - 1; y >= 0; y--)
+		append(out, &img.rgb[y * row], row * sizeof(float));
+	return write_file(path, out);
+}
+
+inline void append_exr_attribute(std::vector<uint8_t>& out, const char *name, const char *type, const void *value, int32_t size)
+{
+	append(out, name, strlen(name) + 1);
+	append(out, type, strlen(type) + 1);
+	append(out, &size, 4);
+	append(out, value, size);
+}
+
+//Linear float OpenEXR: single part scanline file, uncompressed, 32-bit float
+//	R, G and B channels. The smallest layout every EXR reader accepts.
+inline bool write_exr(const std::string& path, const image_buffer& img)
+{
+	std::vector<uint8_t> out;
+	const uint8_t magic[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 }; //version 2, scanline
+	append(out, magic, 8);
+
+	//Channels are stored in alphabetical order
+	const char *names[3] = { "B", "G", "R" };
+	std::vector<uint8_t> channels;
+	for (int c = 0; c < 3; c++)
+	{
+		int32_t channel[4] = { 2, 0, 1, 1 }; //FLOAT, linear flag and reserved bytes, x and y sampling
+		append(channels, names[c], 2);
+		append(channels, channel, sizeof(channel));
+	}
+	channels.push_back(0);
+	append_exr_attribute(out, "channels", "chlist", channels.data(), int32_t(channels.size()));
+	uint8_t no_compression = 0, increasing_y = 0;
+	append_exr_attribute(out, "compression", "compression", &no_compression, 1);
+	int32_t window[4] = { 0, 0, img.width - 1, img.height - 1 };
+	append_exr_attribute(out, "dataWindow", "box2i", window, sizeof(window));
+	append_exr_attribute(out, "displayWindow", "box2i", window, sizeof(window));
+	append_exr_attribute(out, "lineOrder", "lineOrder", &increasing_y, 1);
+	float aspect = 1.0f, center[2] = { 0.0f, 0.0f }, screen_width = 1.0f;
+	append_exr_attribute(out, "pixelAspectRatio", "float", &aspect, 4);
+	append_exr_attribute(out, "screenWindowCenter", "v2f", center, sizeof(center));
+	append_exr_attribute(out, "screenWindowWidth", "float", &screen_width, 4);
+	out.push_back(0);
+
+	//Offset table, then one chunk per scanline: y, byte count and the
+	//	row of every channel in turn
+	int32_t line_bytes = img.width * 3 * int32_t(sizeof(float));
+	uint64_t offset = out.size() + uint64_t(img.height) * 8;
+	for (int y = 0; y < img.height; y++)
+	{
+		append(out, &offset, 8);
+		offset += 8 + line_bytes;
+	}
+	std::vector<float> line(size_t(img.width) * 3);
+	for (int32_t y = 0; y < img.height; y++)
+	{
+		const float *src = &img.rgb[size_t(y) * img.width * 3];
+		for (int x = 0; x < img.width; x++)
+		{
+			line[x] = src[x * 3 + 2];
+			line[img.width + x] = src[x * 3 + 1];
+			line[2 * img.width + x] = src[x * 3 + 0];
+		}
+		append(out, &y, 4);
+		append(out, &line_bytes, 4);
+		append(out, line.data(), line_bytes);
+	}
+	return write_file(path, out);
+}
+
+//Writer picked by the file extension: .png, .pfm, .exr, anything else PPM
+inline bool write_image(const std::string& path, const image_buffer& img)
+{
+	std::string ext = path.substr(std::min(path.size(), path.rfind('.')));
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	if (ext == ".png")
+		return write_png(path, img);
+	else if (ext == ".pfm")
+		return write_pfm(path, img);
+	else if (ext == ".exr")
+		return write_exr(path, img);
+	return write_ppm(path, img);
+}
+
+//Saves on a background thread so the caller can get on with the next frame.
+//	One save at a time: a new one waits for the previous to finish.
+class image_writer
+{
+public:
+	image_writer() : ok(true) {}
+	~image_writer() { wait(); }
+
+	void save(const std::string& path, image_buffer img)
+	{
+		wait();
+		worker = std::thread([this, path](image_buffer frame) { ok = write_image(path, frame); }, std::move(img));
+	}
+
+	//Blocks until the last save is done, false if it failed
+	bool wait()
+	{
+		if (worker.joinable())
+			worker.join();
+		return ok;
+	}
+
+private:
+	std::thread worker;
+	bool ok;
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include "hitable.h"
+#include "rotate.h"
+#include "arena.h"
+#include <cfloat>
+
+//Affine map p -> M p + t as a 3x4 row major matrix, the last column is t
+struct affine_transform
+{
+	affine_transform()
+	{
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 4; j++)
+				m[i][j] = i == j ? 1.0f : 0.0f;
+	}
+
+	static affine_transform translation(const vec3& offset)
+	{
+		affine_transform a;
+		for (int i = 0; i < 3; i++)
+			a.m[i][3] = offset[i];
+		return a;
+	}
+
+	//Rotation about axis (0 x, 1 y, 2 z) the way rotate_x, rotate_y and
+	//	rotate_z turn their object, from the sine and cosine they keep
+	static affine_transform rotation(int axis, float sin_theta, float cos_theta)
+	{
+		affine_transform a;
+		int i = (axis + 1) % 3, j = (axis + 2) % 3;
+		a.m[i][i] = cos_theta;
+		a.m[i][j] = -sin_theta;
+		a.m[j][i] = sin_theta;
+		a.m[j][j] = cos_theta;
+		return a;
+	}
+
+	//This after b
+	affine_transform operator*(const affine_transform& b) const
+	{
+		affine_transform a;
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				a.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+				if (j == 3)
+					a.m[i][j] += m[i][3];
+			}
+		}
+		return a;
+	}
+
+	vec3 point(const vec3& p) const
+	{
+		return vec3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+			m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+			m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+	}
+
+	vec3 vector(const vec3& v) const
+	{
+		return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+			m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+			m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+	}
+
+	vec3 offset() const { return vec3(m[0][3], m[1][3], m[2][3]); }
+
+	affine_transform inverse() const
+	{
+		//Adjugate over the determinant for the 3x3 part, then -M^-1 t
+		affine_transform a;
+		float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+		float inv_det = 1.0f / det;
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+				a.m[i][j] = (m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1]) * inv_det;
+			}
+		}
+		vec3 t = a.vector(offset());
+		for (int i = 0; i < 3; i++)
+			a.m[i][3] = -t[i];
+		return a;
+	}
+
+	//No rotation, possibly an offset
+	bool is_translation() const
+	{
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				if (m[i][j] != (i == j ? 1.0f : 0.0f))
+					return false;
+		return true;
+	}
+
+	bool is_identity() const { return is_translation() && m[0][3] == 0.0f && m[1][3] == 0.0f && m[2][3] == 0.0f; }
+
+	//Bounds of box once transformed: per axis, every matrix entry picks
+	//	the box end that makes its term smallest or largest (Arvo)
+	aabb bounds(const aabb& box) const
+	{
+		vec3 lo = offset(), hi = offset();
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				float a = m[i][j] * box.min()[j];
+				float b = m[i][j] * box.max()[j];
+				lo[i] += ffmin(a, b);
+				hi[i] += ffmax(a, b);
+			}
+		}
+		return aabb(lo, hi);
+	}
+
+	float m[3][4];
+};
+
+//One object placed by one transform, what a chain of translate, rotate and
+//	flip_normals wrappers collapses to. A hit transforms the ray into the
+//	object's frame once and the hit point and normal back once, instead of
+//	building a new ray in every layer. Only rigid transforms come out of
+//	such chains, so the normal goes back through to_world unchanged in
+//	length.
+class instance : public hitable
+{
+public:
+	instance() {}
+	instance(hitable *p, const affine_transform& object_to_world, bool flip_normal = false) : ptr(p), flip(flip_normal)
+	{
+		place(object_to_world);
+	}
+
+	//Moves the instance, the object it places is left as it is
+	void place(const affine_transform& object_to_world)
+	{
+		to_world = object_to_world;
+		to_object = object_to_world.inverse();
+		aabb box;
+		hasbox = ptr->bounding_box(box);
+		if (hasbox)
+			bbox = to_world.bounds(box);
+	}
+
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return ptr->occluded(object_ray(r), t_min, t_max);
+	}
+	virtual bool bounding_box(aabb& box) const
+	{
+		box = bbox;
+		return hasbox;
+	}
+	virtual float pdf_value(const vec3& o, const vec3& v) const { return ptr->pdf_value(to_object.point(o), to_object.vector(v)); }
+	virtual vec3 random(const vec3& o) const { return to_world.vector(ptr->random(to_object.point(o))); }
+
+	//The ray in the object's frame, with the same t along it
+	ray object_ray(const ray& r) const { return ray(to_object.point(r.origin()), to_object.vector(r.direction())); }
+
+	hitable *ptr;
+	affine_transform to_world, to_object;
+	bool flip;
+	bool hasbox;
+	aabb bbox;
+};
+
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	if (!ptr->hit(object_ray(r), t_min, t_max, rec))
+		return false;
+	rec.p = to_world.point(rec.p);
+	rec.normal = to_world.vector(rec.normal);
+	if (flip)
+		rec.normal = -rec.normal;
+	return true;
+}
+
+//Strips the translate, rotate_x/y/z, flip_normals and instance wrappers off
+//	object and returns what they wrap. Their combined object to world
+//	transform is applied after to_world, and flip toggles with every flip.
+inline hitable *peel_transforms(hitable *object, affine_transform& to_world, bool& flip)
+{
+	for (;;)
+	{
+		if (translate *t = dynamic_cast<translate*>(object))
+		{
+			to_world = to_world * affine_transform::translation(t->offset);
+			object = t->ptr;
+		}
+		else if (rotate_x *rx = dynamic_cast<rotate_x*>(object))
+		{
+			to_world = to_world * affine_transform::rotation(0, rx->sin_theta, rx->cos_theta);
+			object = rx->ptr;
+		}
+		else if (rotate_y *ry = dynamic_cast<rotate_y*>(object))
+		{
+			to_world = to_world * affine_transform::rotation(1, ry->sin_theta, ry->cos_theta);
+			object = ry->ptr;
+		}
+		else if (rotate_z *rz = dynamic_cast<rotate_z*>(object))
+		{
+			to_world = to_world * affine_transform::rotation(2, rz->sin_theta, rz->cos_theta);
+			object = rz->ptr;
+		}
+		else if (flip_normals *f = dynamic_cast<flip_normals*>(object))
+		{
+			flip = !flip;
+			object = f->ptr;
+		}
+		else if (instance *in = dynamic_cast<instance*>(object))
+		{
+			to_world = to_world * in->to_world;
+			flip = flip != in->flip;
+			object = in->ptr;
+		}
+		else
+			return object;
+	}
+}
+
+//object with its chain of wrappers collapsed into at most one instance,
+//	created in memory. Left as it is if there is no chain to collapse, or
+//	if it is an instance already, which may be moved later.
+inline hitable *flatten_transforms(hitable *object, arena& memory)
+{
+	affine_transform to_world;
+	bool flip = false;
+	hitable *leaf = peel_transforms(object, to_world, flip);
+	if (leaf == object || dynamic_cast<instance*>(object))
+		return object;
+	if (to_world.is_identity())
+		return flip ? memory.create<flip_normals>(leaf) : leaf;
+	return memory.create<instance>(leaf, to_world, flip);
+}
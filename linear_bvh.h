@@ -0,0 +1,238 @@
+#pragma once
+#include "bvh.h"
+#include <stdint.h>
+#include <cassert>
+
+//The built BVH compiled into one contiguous array in depth-first order.
+//	The first child of an interior node directly follows it in the array,
+//	so only the offset of the second child has to be stored.
+struct linear_bvh_node
+{
+	aabb bounds;
+	union
+	{
+		int primitives_offset; //leaf
+		int second_child_offset; //interior
+	};
+	uint16_t n_primitives; //0 -> interior node
+	uint8_t axis; //interior node split axis
+	uint8_t pad;
+};
+
+//An interior node at depth d leaves at most d + 1 entries on the stack and
+//	no interior node is deeper than BVH_MAX_DEPTH - 1
+const int LINEAR_BVH_STACK_SIZE = 64;
+static_assert(LINEAR_BVH_STACK_SIZE >= BVH_MAX_DEPTH, "linear BVH stack too small for the build depth");
+
+int flatten_bvh_tree(const bvh_build_node *node, std::vector<linear_bvh_node>& nodes)
+{
+	int offset = int(nodes.size());
+	nodes.push_back(linear_bvh_node());
+	nodes[offset].bounds = node->bounds;
+	if (node->n_primitives > 0)
+	{
+		nodes[offset].primitives_offset = node->first_prim_offset;
+		nodes[offset].n_primitives = uint16_t(node->n_primitives);
+	}
+	else
+	{
+		nodes[offset].axis = uint8_t(node->split_axis);
+		nodes[offset].n_primitives = 0;
+		flatten_bvh_tree(node->children[0], nodes);
+		int second = flatten_bvh_tree(node->children[1], nodes);
+		nodes[offset].second_child_offset = second;
+	}
+	return offset;
+}
+
+//Non-recursive closest-hit traversal over a flattened BVH. The child on the
+//	near side of the split axis is visited first and the far one is pushed,
+//	so by the time it is popped closest_so_far usually culls it.
+//	intersect_leaf(first, count, t_min, closest) tests the primitives of a leaf,
+//	shrinks closest on a hit and returns whether anything was hit.
+template<typename LeafFunc>
+bool traverse_linear_bvh(const linear_bvh_node *nodes, const ray& r, float t_min, float t_max, LeafFunc intersect_leaf)
+{
+	int stack[LINEAR_BVH_STACK_SIZE];
+	int to_visit = 0;
+	int current = 0;
+	int dir_is_neg[3] = { r.direction().x() < 0.0f, r.direction().y() < 0.0f, r.direction().z() < 0.0f };
+	bool hit_anything = false;
+	float closest_so_far = t_max;
+	while (true)
+	{
+		const linear_bvh_node& node = nodes[current];
+		if (node.bounds.hit(r, t_min, closest_so_far))
+		{
+			if (node.n_primitives > 0)
+			{
+				if (intersect_leaf(node.primitives_offset, node.n_primitives, t_min, closest_so_far))
+					hit_anything = true;
+				if (to_visit == 0)
+					break;
+				current = stack[--to_visit];
+			}
+			else
+			{
+				assert(to_visit < LINEAR_BVH_STACK_SIZE);
+				if (dir_is_neg[node.axis])
+				{
+					stack[to_visit++] = current + 1;
+					current = node.second_child_offset;
+				}
+				else
+				{
+					stack[to_visit++] = node.second_child_offset;
+					current = current + 1;
+				}
+			}
+		}
+		else
+		{
+			if (to_visit == 0)
+				break;
+			current = stack[--to_visit];
+		}
+	}
+	return hit_anything;
+}
+
+//Any-hit traversal: same order as traverse_linear_bvh but stops at the first
+//	leaf for which occluded_leaf(first, count) reports a hit.
+template<typename LeafFunc>
+bool occluded_linear_bvh(const linear_bvh_node *nodes, const ray& r, float t_min, float t_max, LeafFunc occluded_leaf)
+{
+	int stack[LINEAR_BVH_STACK_SIZE];
+	int to_visit = 0;
+	int current = 0;
+	int dir_is_neg[3] = { r.direction().x() < 0.0f, r.direction().y() < 0.0f, r.direction().z() < 0.0f };
+	while (true)
+	{
+		const linear_bvh_node& node = nodes[current];
+		if (node.bounds.hit(r, t_min, t_max))
+		{
+			if (node.n_primitives > 0)
+			{
+				if (occluded_leaf(node.primitives_offset, node.n_primitives))
+					return true;
+				if (to_visit == 0)
+					break;
+				current = stack[--to_visit];
+			}
+			else
+			{
+				assert(to_visit < LINEAR_BVH_STACK_SIZE);
+				if (dir_is_neg[node.axis])
+				{
+					stack[to_visit++] = current + 1;
+					current = node.second_child_offset;
+				}
+				else
+				{
+					stack[to_visit++] = node.second_child_offset;
+					current = current + 1;
+				}
+			}
+		}
+		else
+		{
+			if (to_visit == 0)
+				break;
+			current = stack[--to_visit];
+		}
+	}
+	return false;
+}
+
+class linear_bvh : public hitable
+{
+public:
+	linear_bvh() {}
+	linear_bvh(hitable **l, int n, bvh_quality quality = BVH_MEDIUM, int max_prims_in_node = 4);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual bool bounding_box(aabb& box) const
+	{
+		box = nodes[0].bounds;
+		return true;
+	}
+
+	//Expected cost of a random ray under the surface area heuristic
+	float sah_cost() const;
+
+	std::vector<linear_bvh_node> nodes;
+	std::vector<hitable*> primitives; //in leaf order
+};
+
+linear_bvh::linear_bvh(hitable **l, int n, bvh_quality quality, int max_prims_in_node)
+{
+	std::vector<bvh_primitive_info> info = bvh_compute_primitive_info(l, n);
+
+	int total_nodes = 0;
+	std::vector<int> ordered;
+	bvh_build_node *root = bvh_build(info, max_prims_in_node, quality, total_nodes, ordered);
+
+	primitives.resize(n);
+	for (int i = 0; i < n; i++)
+		primitives[i] = l[ordered[i]];
+
+	nodes.reserve(total_nodes);
+	flatten_bvh_tree(root, nodes);
+	bvh_free_build_tree(root);
+}
+
+bool linear_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	hitable *const *prims = primitives.data();
+	return traverse_linear_bvh(nodes.data(), r, t_min, t_max,
+		[&](int first, int count, float t0, float& closest)
+	{
+		hit_record temp_rec;
+		bool hit_anything = false;
+		for (int i = first; i < first + count; i++)
+		{
+			if (prims[i]->hit(r, t0, closest, temp_rec))
+			{
+				hit_anything = true;
+				closest = temp_rec.t;
+				rec = temp_rec;
+			}
+		}
+		return hit_anything;
+	});
+}
+
+bool linear_bvh::occluded(const ray& r, float t_min, float t_max) const
+{
+	hitable *const *prims = primitives.data();
+	return occluded_linear_bvh(nodes.data(), r, t_min, t_max,
+		[&](int first, int count)
+	{
+		for (int i = first; i < first + count; i++)
+		{
+			if (prims[i]->occluded(r, t_min, t_max))
+				return true;
+		}
+		return false;
+	});
+}
+
+float linear_bvh::sah_cost() const
+{
+	//Children always follow their parent, so a reverse sweep sees them first
+	std::vector<float> cost(nodes.size());
+	for (int i = int(nodes.size()) - 1; i >= 0; i--)
+	{
+		const linear_bvh_node& node = nodes[i];
+		if (node.n_primitives > 0)
+		{
+			cost[i] = float(node.n_primitives);
+		}
+		else
+		{
+			int c0 = i + 1, c1 = node.second_child_offset;
+			cost[i] = BVH_TRAVERSAL_COST + (nodes[c0].bounds.area() * cost[c0] + nodes[c1].bounds.area() * cost[c1]) / node.bounds.area();
+		}
+	}
+	return cost[0];
+}
@@ -1,22 +1,39 @@
 #pragma once
 #include "hitable.h"
+#include "sampler.h"
 
 #include <stdlib.h>
 #include <limits>
 
-#define drand48() (rand() / (RAND_MAX + 1.0))
-
 vec3 random_in_unit_sphere();
+vec3 random_unit_vector();
 vec3 reflect(const vec3& v, const vec3& n);
 bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted);
 float schlick(float cosine, float ref_idx);
 
+//Concrete material type, lets the wavefront integrator shade hits grouped by type
+enum material_kind
+{
+	MATERIAL_LAMBERTIAN,
+	MATERIAL_METAL,
+	MATERIAL_DIELECTRIC,
+	MATERIAL_DIFFUSE_LIGHT,
+	MATERIAL_KIND_COUNT
+};
+
 //Abstract Class
 class material
 {
 public:
 	virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const = 0;
 	virtual vec3 emitted() const { return vec3(0, 0, 0); }
+	virtual material_kind kind() const = 0;
+
+	//Diffuse materials can be lit by sampling the lights directly.
+	//	scattering_pdf is the density of scatter() choosing scattered's
+	//	direction; with the attenuation it also gives the BRDF times cosine.
+	virtual bool is_diffuse() const { return false; }
+	virtual float scattering_pdf(const ray& /*r_in*/, const hit_record& /*rec*/, const ray& /*scattered*/) const { return 0.0f; }
 };
 //material tells us how rays interact with the surface
 
@@ -24,13 +41,23 @@ class lambertian :public material
 {
 public:
 	lambertian(const vec3& a) :albedo(a) {}
+	//Cosine weighted: a point on the unit sphere around the tip of the normal
 	virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
 	{
-		vec3 target = rec.p + rec.normal + random_in_unit_sphere();
-		scattered = ray(rec.p, target - rec.p);
+		vec3 direction = rec.normal + random_unit_vector();
+		if (direction.squared_length() < 1e-8f)
+			direction = rec.normal;
+		scattered = ray(rec.p, direction);
 		attenuation = albedo;
 		return true;
 	}
+	virtual material_kind kind() const { return MATERIAL_LAMBERTIAN; }
+	virtual bool is_diffuse() const { return true; }
+	virtual float scattering_pdf(const ray& /*r_in*/, const hit_record& rec, const ray& scattered) const
+	{
+		float cosine = dot(rec.normal, scattered.direction()) / scattered.DirLength();
+		return cosine > 0 ? cosine / M_PI : 0.0f;
+	}
 
 	vec3 albedo;
 };
@@ -46,6 +73,7 @@ public:
 		attenuation = albedo;
 		return (dot(scattered.direction(), rec.normal) > 0);
 	}
+	virtual material_kind kind() const { return MATERIAL_METAL; }
 	vec3 albedo;
 	float fuzz;
 };
@@ -61,6 +89,7 @@ public:
 	{
 		return emit;
 	}
+	virtual material_kind kind() const { return MATERIAL_DIFFUSE_LIGHT; }
 
 	vec3 emit;
 };
@@ -107,7 +136,7 @@ public:
 		}
 
 		//When a light ray hits the dielectric surface it splits into a reflected ray and a refracted (transmitted) ray. We'll handle that by randomly choosing between reflection or refraction and only generating one scattered ray per interaction.
-		if (drand48() < reflect_prob)
+		if (random_float() < reflect_prob)
 		{
 			scattered = ray(rec.p, reflected);
 		}
@@ -118,6 +147,7 @@ public:
 
 		return true;
 	}
+	virtual material_kind kind() const { return MATERIAL_DIELECTRIC; }
 
 	float ref_idx;
 };
@@ -132,11 +162,19 @@ vec3 random_in_unit_sphere()
 	vec3 p;
 	do
 	{
-		p = 2.0 * vec3(drand48(), drand48(), drand48()) - vec3(1, 1, 1);
+		p = 2.0 * vec3(random_float(), random_float(), random_float()) - vec3(1, 1, 1);
 	} while (p.squared_length() >= 1.0);
 	return p;
 }
 
+vec3 random_unit_vector()
+{
+	float z = 1 - 2 * random_float();
+	float phi = 2 * M_PI * random_float();
+	float r = sqrt(std::max(0.0f, 1 - z * z));
+	return vec3(r * cos(phi), r * sin(phi), z);
+}
+
 bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted)
 {
 	vec3 uv = unit_vector(v);
@@ -0,0 +1,339 @@
+#pragma once
+
+#include "triangle_mesh.h"
+#include "arena.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//Whole file mapped read-only. The pages come from the page cache, so every
+//	process mapping the same file shares one copy.
+class mapped_file
+{
+public:
+	mapped_file() : data(NULL), size(0) {}
+	~mapped_file() { close(); }
+
+	bool open(const std::string& path)
+	{
+		close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER file_size;
+		HANDLE mapping = NULL;
+		if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+		if (!mapping)
+			return false;
+		data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		size = size_t(file_size.QuadPart);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		void *p = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			p = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		data = (const uint8_t*)p;
+		size = size_t(st.st_size);
+#endif
+		if (!data)
+			size = 0;
+		return data != NULL;
+	}
+
+	void close()
+	{
+		if (!data)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap((void*)data, size);
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	const uint8_t *data;
+	size_t size;
+};
+
+//Mesh cache file: every triangle mesh of a scene with its BVH, as built, so
+//	a later run can trace straight from the mapped file without parsing the
+//	OBJ files or building anything. The file holds no pointers, only offsets
+//	from its start, and every array starts on a MESH_CACHE_ALIGN boundary.
+//
+//	header | n_meshes entries | arrays of mesh 0 | arrays of mesh 1 | ...
+//
+//	It is only valid for the build that wrote it (version and layout). Each
+//	entry records the OBJ file's path, size and modification time and the
+//	scale it was loaded with, and meshes are looked up by those, not by
+//	their place in the scene. Editing the rest of the scene (the camera,
+//	materials, other primitives) keeps the cache, editing a mesh only
+//	rebuilds that mesh.
+const char MESH_CACHE_MAGIC[8] = { 'C', 'B', 'M', 'E', 'S', 'H', '\r', '\n' };
+const uint32_t MESH_CACHE_VERSION = 3;
+const uint32_t MESH_CACHE_ALIGN = 64;
+
+struct mesh_cache_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t n_meshes;
+	uint32_t layout[6]; //byte order, struct sizes and packet width of the build
+};
+
+//Where a mesh came from, a cached mesh is only used if all of it matches
+struct mesh_cache_source
+{
+	mesh_cache_source() : path_hash(0), file_size(0), file_mtime(0), scale(1.0f), pad(0) {}
+
+	bool operator==(const mesh_cache_source& o) const
+	{
+		return path_hash == o.path_hash && file_size == o.file_size && file_mtime == o.file_mtime && scale == o.scale;
+	}
+
+	uint64_t path_hash; //of the path as the scene gives it
+	uint64_t file_size;
+	int64_t file_mtime;
+	float scale;
+	uint32_t pad;
+};
+
+enum mesh_cache_array
+{
+	MESH_CACHE_VERTICES,
+	MESH_CACHE_INDICES,
+	MESH_CACHE_NODES,
+	MESH_CACHE_PACKETS,
+	MESH_CACHE_ARRAYS
+};
+
+struct mesh_cache_entry
+{
+	mesh_cache_source source;
+	uint64_t offset[MESH_CACHE_ARRAYS];
+	uint64_t count[MESH_CACHE_ARRAYS];
+};
+
+inline void mesh_cache_layout(uint32_t layout[6])
+{
+	layout[0] = 0x01020304; //read back in another byte order it won't match
+	layout[1] = sizeof(vec3);
+	layout[2] = sizeof(linear_bvh_node);
+	layout[3] = sizeof(triangle_packet);
+	layout[4] = TRIANGLE_PACKET_WIDTH;
+	layout[5] = sizeof(mesh_cache_entry);
+}
+
+//FNV-1a, to tell mesh paths apart
+inline uint64_t hash_bytes(const void *p, size_t n, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+	const uint8_t *bytes = (const uint8_t*)p;
+	for (size_t i = 0; i < n; i++)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	return hash;
+}
+
+//Size and modification time of the file a mesh is loaded from
+inline mesh_cache_source mesh_source(const std::string& path, float scale)
+{
+	mesh_cache_source source;
+	source.path_hash = hash_bytes(path.data(), path.size());
+	struct stat st;
+	if (stat(path.c_str(), &st) == 0)
+	{
+		source.file_size = uint64_t(st.st_size);
+		source.file_mtime = int64_t(st.st_mtime);
+	}
+	source.scale = scale;
+	return source;
+}
+
+//Mesh cache opened for reading
+class mesh_cache
+{
+public:
+	mesh_cache() : header(NULL), entries(NULL) {}
+
+	//False if there is no cache at path or it is from another build
+	bool open(const std::string& path)
+	{
+		if (!file.open(path) || file.size < sizeof(mesh_cache_header))
+			return false;
+		header = (const mesh_cache_header*)file.data;
+		uint32_t layout[6];
+		mesh_cache_layout(layout);
+		bool valid = memcmp(header->magic, MESH_CACHE_MAGIC, 8) == 0 && header->version == MESH_CACHE_VERSION
+			&& memcmp(header->layout, layout, sizeof(layout)) == 0
+			&& file.size >= sizeof(mesh_cache_header) + uint64_t(header->n_meshes) * sizeof(mesh_cache_entry);
+		if (!valid)
+		{
+			file.close();
+			header = NULL;
+			return false;
+		}
+		entries = (const mesh_cache_entry*)(file.data + sizeof(mesh_cache_header));
+		return true;
+	}
+
+	int size() const { return header ? int(header->n_meshes) : 0; }
+
+	//The mesh loaded from source over the mapped arrays, created in memory,
+	//	NULL if it isn't cached. A scene has few meshes, a linear search will
+	//	do.
+	triangle_mesh *mesh(const mesh_cache_source& source, material *mat, arena& memory) const
+	{
+		int i = 0;
+		while (i < size() && !(entries[i].source == source))
+			i++;
+		if (i == size())
+			return NULL;
+		const mesh_cache_entry& e = entries[i];
+		const size_t sizes[MESH_CACHE_ARRAYS] = { sizeof(vec3), sizeof(uint32_t), sizeof(linear_bvh_node), sizeof(triangle_packet) };
+		for (int a = 0; a < MESH_CACHE_ARRAYS; a++)
+		{
+			if (e.offset[a] % MESH_CACHE_ALIGN != 0 || e.offset[a] > file.size || e.count[a] > (file.size - e.offset[a]) / sizes[a]
+				|| e.count[a] > uint64_t(INT32_MAX))
+				return NULL;
+		}
+		array_view<const vec3> vertices(mapped_array<vec3>(e, MESH_CACHE_VERTICES), size_t(e.count[MESH_CACHE_VERTICES]));
+		array_view<const uint32_t> indices(mapped_array<uint32_t>(e, MESH_CACHE_INDICES), size_t(e.count[MESH_CACHE_INDICES]));
+		array_view<const linear_bvh_node> nodes(mapped_array<linear_bvh_node>(e, MESH_CACHE_NODES), size_t(e.count[MESH_CACHE_NODES]));
+		array_view<const triangle_packet> packets(mapped_array<triangle_packet>(e, MESH_CACHE_PACKETS), size_t(e.count[MESH_CACHE_PACKETS]));
+		if (!valid_mesh(vertices, indices, nodes, packets))
+			return NULL;
+		return memory.create<triangle_mesh>(vertices, indices, nodes, packets, mat);
+	}
+
+private:
+	//Checks everything the traversal indexes with, so a damaged cache is
+	//	rebuilt instead of read out of bounds: the nodes must form one tree
+	//	in depth first order no deeper than BVH_MAX_DEPTH, leaves must point
+	//	at packets, packet lanes at triangles and indices at vertices. It
+	//	reads the arrays once, which is still far less than loading the OBJ.
+	static bool valid_mesh(array_view<const vec3> vertices, array_view<const uint32_t> indices, array_view<const linear_bvh_node> nodes, array_view<const triangle_packet> packets)
+	{
+		if (indices.size() % 3 != 0 || nodes.size() == 0 || valid_subtree(nodes, packets.size(), 0, 0) != int(nodes.size()))
+			return false;
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			if (indices[i] >= vertices.size())
+				return false;
+		}
+		int n_triangles = int(indices.size() / 3);
+		for (size_t i = 0; i < packets.size(); i++)
+		{
+			for (int lane = 0; lane < TRIANGLE_PACKET_WIDTH; lane++)
+			{
+				if (packets[i].id[lane] < -1 || packets[i].id[lane] >= n_triangles)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	//Index just past the subtree at node, -1 if it isn't well formed
+	static int valid_subtree(array_view<const linear_bvh_node> nodes, size_t n_packets, int node, int depth)
+	{
+		if (node >= int(nodes.size()) || depth > BVH_MAX_DEPTH)
+			return -1;
+		const linear_bvh_node& n = nodes[node];
+		if (n.n_primitives > 0)
+			return n.primitives_offset >= 0 && size_t(n.primitives_offset) + n.n_primitives <= n_packets ? node + 1 : -1;
+		if (n.axis > 2)
+			return -1;
+		int second = valid_subtree(nodes, n_packets, node + 1, depth + 1);
+		if (second < 0 || n.second_child_offset != second)
+			return -1;
+		return valid_subtree(nodes, n_packets, second, depth + 1);
+	}
+
+	template<typename T>
+	const T *mapped_array(const mesh_cache_entry& e, mesh_cache_array a) const
+	{
+		return (const T*)(file.data + e.offset[a]);
+	}
+
+	mapped_file file;
+	const mesh_cache_header *header;
+	const mesh_cache_entry *entries;
+};
+
+inline void pad_to(std::vector<uint8_t>& out, size_t align)
+{
+	out.resize((out.size() + align - 1) / align * align, 0);
+}
+
+//Writes meshes, loaded from sources, as a scene's cache. Goes through a temporary file that replaces the old cache
+//	at the end, so processes still mapping the old one are unaffected.
+inline bool write_mesh_cache(const std::string& path, const std::vector<mesh_cache_source>& sources, const std::vector<const triangle_mesh*>& meshes)
+{
+	std::vector<uint8_t> out(sizeof(mesh_cache_header) + meshes.size() * sizeof(mesh_cache_entry), 0);
+	std::vector<mesh_cache_entry> entries(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		const triangle_mesh *m = meshes[i];
+		const void *arrays[MESH_CACHE_ARRAYS] = { m->vertices.data(), m->indices.data(), m->nodes.data(), m->packets.data() };
+		const size_t counts[MESH_CACHE_ARRAYS] = { m->vertices.size(), m->indices.size(), m->nodes.size(), m->packets.size() };
+		const size_t sizes[MESH_CACHE_ARRAYS] = { sizeof(vec3), sizeof(uint32_t), sizeof(linear_bvh_node), sizeof(triangle_packet) };
+		entries[i].source = sources[i];
+		for (int a = 0; a < MESH_CACHE_ARRAYS; a++)
+		{
+			pad_to(out, MESH_CACHE_ALIGN);
+			entries[i].offset[a] = out.size();
+			entries[i].count[a] = counts[a];
+			const uint8_t *p = (const uint8_t*)arrays[a];
+			out.insert(out.end(), p, p + counts[a] * sizes[a]);
+		}
+	}
+
+	mesh_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MESH_CACHE_MAGIC, 8);
+	header.version = MESH_CACHE_VERSION;
+	header.n_meshes = uint32_t(meshes.size());
+	mesh_cache_layout(header.layout);
+	memcpy(out.data(), &header, sizeof(header));
+	if (!entries.empty())
+		memcpy(out.data() + sizeof(header), entries.data(), entries.size() * sizeof(mesh_cache_entry));
+
+	std::string tmp = path + ".tmp";
+	{
+		std::ofstream fout(tmp.c_str(), std::ios::binary | std::ios::trunc);
+		if (!fout || !fout.write((const char*)out.data(), out.size()))
+			return false;
+	}
+#ifdef _WIN32
+	remove(path.c_str()); //rename doesn't replace on Windows
+#endif
+	if (rename(tmp.c_str(), path.c_str()) != 0)
+	{
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,338 @@
+#pragma once
+
+#include "hitable.h"
+#include "sphere.h"
+#include "rect.h"
+#include "box.h"
+#include "triangle.h"
+#include "instance.h"
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+//Primitive kinds a primitive_store keeps in contiguous arrays of their own.
+//	Anything else (meshes, lists) stays a hitable and is still reached
+//	through its vtable, behind an instance if it is transformed.
+enum primitive_tag
+{
+	PRIMITIVE_SPHERE,
+	PRIMITIVE_XY_RECT,
+	PRIMITIVE_XZ_RECT,
+	PRIMITIVE_YZ_RECT,
+	PRIMITIVE_QUAD,
+	PRIMITIVE_TRIANGLE,
+	PRIMITIVE_INSTANCE,
+	PRIMITIVE_HITABLE
+};
+
+//Reference to a primitive in a store: the tag in the top 3 bits, a flag to
+//	flip the normal, and the index into the tag's array. Sorting handles
+//	groups them by tag.
+typedef uint32_t primitive_handle;
+
+const int PRIMITIVE_TAG_SHIFT = 29;
+const uint32_t PRIMITIVE_FLIP = 1u << 28;
+const uint32_t PRIMITIVE_INDEX_MASK = PRIMITIVE_FLIP - 1;
+
+inline primitive_handle make_primitive_handle(primitive_tag tag, size_t index, bool flip)
+{
+	return (uint32_t(tag) << PRIMITIVE_TAG_SHIFT) | (flip ? PRIMITIVE_FLIP : 0) | uint32_t(index);
+}
+
+inline primitive_tag handle_tag(primitive_handle h) { return primitive_tag(h >> PRIMITIVE_TAG_SHIFT); }
+inline uint32_t handle_index(primitive_handle h) { return h & PRIMITIVE_INDEX_MASK; }
+
+//Scene primitives compiled out of the hitable graph into per type arrays.
+//	A handle's tag picks the array with a switch, and the call on the
+//	element is qualified, so it is direct and can be inlined.
+//
+//	Chains of translate, rotate, flip_normals and instance wrappers are
+//	collapsed into one transform (peel_transforms()). A primitive only one
+//	chain leads to gets the transform baked into a copy of its geometry,
+//	so tracing it costs no transform at all: spheres and triangles move,
+//	rects move or turn into quads, a box becomes its six faces. Flips
+//	become the handle's flag. Whatever can't be baked, or is shared by
+//	several chains, becomes one instance with the whole chain's matrix.
+//	Instances passed in as they are, like those of a scene's instance
+//	statements, are kept: they are copied, and can be moved and copied again.
+class primitive_store
+{
+public:
+	//Appends the handles the n objects at l compile to, one or more each
+	void add(hitable **l, int n, std::vector<primitive_handle>& handles)
+	{
+		std::map<hitable*, int> uses;
+		for (int i = 0; i < n; i++)
+		{
+			affine_transform to_world;
+			bool flip = false;
+			if (!dynamic_cast<instance*>(l[i]))
+				uses[peel_transforms(l[i], to_world, flip)]++;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			//Instances passed in may be moved later, they stay instances and
+			//	refresh() copies them again
+			if (instance *in = dynamic_cast<instance*>(l[i]))
+			{
+				handles.push_back(make_primitive_handle(PRIMITIVE_INSTANCE, push(instances, *in), false));
+				instance_sources.push_back(in);
+				continue;
+			}
+			affine_transform to_world;
+			bool flip = false;
+			hitable *leaf = peel_transforms(l[i], to_world, flip);
+			if ((uses[leaf] > 1 && !to_world.is_identity()) || !bake(leaf, flip, to_world, handles))
+			{
+				if (to_world.is_identity())
+					handles.push_back(make_primitive_handle(PRIMITIVE_HITABLE, push(hitables, leaf), flip));
+				else
+				{
+					handles.push_back(make_primitive_handle(PRIMITIVE_INSTANCE, push(instances, instance(leaf, to_world)), flip));
+					instance_sources.push_back(NULL);
+				}
+			}
+		}
+	}
+
+	//Copies again the instances passed to add(), after they were moved
+	void refresh()
+	{
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			if (instance_sources[i])
+				instances[i] = *instance_sources[i];
+		}
+	}
+
+	aabb bounds(primitive_handle h) const
+	{
+		aabb box;
+		uint32_t i = handle_index(h);
+		switch (handle_tag(h))
+		{
+		case PRIMITIVE_SPHERE: spheres[i].sphere::bounding_box(box); break;
+		case PRIMITIVE_XY_RECT: xy_rects[i].xy_rect::bounding_box(box); break;
+		case PRIMITIVE_XZ_RECT: xz_rects[i].xz_rect::bounding_box(box); break;
+		case PRIMITIVE_YZ_RECT: yz_rects[i].yz_rect::bounding_box(box); break;
+		case PRIMITIVE_QUAD: quads[i].quad::bounding_box(box); break;
+		case PRIMITIVE_TRIANGLE: triangles[i].triangle::bounding_box(box); break;
+		case PRIMITIVE_INSTANCE: instances[i].instance::bounding_box(box); break;
+		default: hitables[i]->bounding_box(box); break;
+		}
+		return box;
+	}
+
+	bool hit(primitive_handle h, const ray& r, float t_min, float t_max, hit_record& rec) const
+	{
+		bool hit;
+		uint32_t i = handle_index(h);
+		switch (handle_tag(h))
+		{
+		case PRIMITIVE_SPHERE: hit = spheres[i].sphere::hit(r, t_min, t_max, rec); break;
+		case PRIMITIVE_XY_RECT: hit = xy_rects[i].xy_rect::hit(r, t_min, t_max, rec); break;
+		case PRIMITIVE_XZ_RECT: hit = xz_rects[i].xz_rect::hit(r, t_min, t_max, rec); break;
+		case PRIMITIVE_YZ_RECT: hit = yz_rects[i].yz_rect::hit(r, t_min, t_max, rec); break;
+		case PRIMITIVE_QUAD: hit = quads[i].quad::hit(r, t_min, t_max, rec); break;
+		case PRIMITIVE_TRIANGLE: hit = triangles[i].triangle::hit(r, t_min, t_max, rec); break;
+		case PRIMITIVE_INSTANCE: hit = instances[i].instance::hit(r, t_min, t_max, rec); break;
+		default: hit = hitables[i]->hit(r, t_min, t_max, rec); break;
+		}
+		if (hit && (h & PRIMITIVE_FLIP))
+			rec.normal = -rec.normal;
+		return hit;
+	}
+
+	bool occluded(primitive_handle h, const ray& r, float t_min, float t_max) const
+	{
+		uint32_t i = handle_index(h);
+		switch (handle_tag(h))
+		{
+		case PRIMITIVE_SPHERE: return spheres[i].sphere::occluded(r, t_min, t_max);
+		case PRIMITIVE_XY_RECT: return xy_rects[i].xy_rect::occluded(r, t_min, t_max);
+		case PRIMITIVE_XZ_RECT: return xz_rects[i].xz_rect::occluded(r, t_min, t_max);
+		case PRIMITIVE_YZ_RECT: return yz_rects[i].yz_rect::occluded(r, t_min, t_max);
+		case PRIMITIVE_QUAD: return quads[i].quad::occluded(r, t_min, t_max);
+		case PRIMITIVE_TRIANGLE: return triangles[i].triangle::occluded(r, t_min, t_max);
+		case PRIMITIVE_INSTANCE: return instances[i].instance::occluded(r, t_min, t_max);
+		default: return hitables[i]->occluded(r, t_min, t_max);
+		}
+	}
+
+	//Closest hit among the n handles at h, which are sorted so every tag is
+	//	one run: one switch per run, then a direct loop over that array.
+	//	t_max shrinks to the closest hit.
+	bool hit_range(const primitive_handle *h, int n, const ray& r, float t_min, float& t_max, hit_record& rec) const
+	{
+		bool hit_anything = false;
+		for (int i = 0, j; i < n; i = j)
+		{
+			primitive_tag tag = handle_tag(h[i]);
+			for (j = i + 1; j < n && handle_tag(h[j]) == tag; j++);
+			switch (tag)
+			{
+			case PRIMITIVE_SPHERE: hit_anything |= hit_run(spheres.data(), h + i, j - i, r, t_min, t_max, rec); break;
+			case PRIMITIVE_XY_RECT: hit_anything |= hit_run(xy_rects.data(), h + i, j - i, r, t_min, t_max, rec); break;
+			case PRIMITIVE_XZ_RECT: hit_anything |= hit_run(xz_rects.data(), h + i, j - i, r, t_min, t_max, rec); break;
+			case PRIMITIVE_YZ_RECT: hit_anything |= hit_run(yz_rects.data(), h + i, j - i, r, t_min, t_max, rec); break;
+			case PRIMITIVE_QUAD: hit_anything |= hit_run(quads.data(), h + i, j - i, r, t_min, t_max, rec); break;
+			case PRIMITIVE_TRIANGLE: hit_anything |= hit_run(triangles.data(), h + i, j - i, r, t_min, t_max, rec); break;
+			case PRIMITIVE_INSTANCE: hit_anything |= hit_run(instances.data(), h + i, j - i, r, t_min, t_max, rec); break;
+			default: hit_anything |= hit_run(hitables.data(), h + i, j - i, r, t_min, t_max, rec); break;
+			}
+		}
+		return hit_anything;
+	}
+
+	//Whether any of the n sorted handles at h blocks the segment
+	bool occluded_range(const primitive_handle *h, int n, const ray& r, float t_min, float t_max) const
+	{
+		for (int i = 0, j; i < n; i = j)
+		{
+			primitive_tag tag = handle_tag(h[i]);
+			for (j = i + 1; j < n && handle_tag(h[j]) == tag; j++);
+			bool blocked;
+			switch (tag)
+			{
+			case PRIMITIVE_SPHERE: blocked = occluded_run(spheres.data(), h + i, j - i, r, t_min, t_max); break;
+			case PRIMITIVE_XY_RECT: blocked = occluded_run(xy_rects.data(), h + i, j - i, r, t_min, t_max); break;
+			case PRIMITIVE_XZ_RECT: blocked = occluded_run(xz_rects.data(), h + i, j - i, r, t_min, t_max); break;
+			case PRIMITIVE_YZ_RECT: blocked = occluded_run(yz_rects.data(), h + i, j - i, r, t_min, t_max); break;
+			case PRIMITIVE_QUAD: blocked = occluded_run(quads.data(), h + i, j - i, r, t_min, t_max); break;
+			case PRIMITIVE_TRIANGLE: blocked = occluded_run(triangles.data(), h + i, j - i, r, t_min, t_max); break;
+			case PRIMITIVE_INSTANCE: blocked = occluded_run(instances.data(), h + i, j - i, r, t_min, t_max); break;
+			default: blocked = occluded_run(hitables.data(), h + i, j - i, r, t_min, t_max); break;
+			}
+			if (blocked)
+				return true;
+		}
+		return false;
+	}
+
+	std::vector<sphere> spheres;
+	std::vector<xy_rect> xy_rects;
+	std::vector<xz_rect> xz_rects;
+	std::vector<yz_rect> yz_rects;
+	std::vector<quad> quads;
+	std::vector<triangle> triangles;
+	std::vector<instance> instances;
+	std::vector<const instance*> instance_sources; //of each of instances, NULL for those add() made, not owned
+	std::vector<hitable*> hitables; //what doesn't compile, not owned
+
+private:
+	//The element a run is traced with: the primitive itself, called without
+	//	the vtable, or the hitable a fallback handle points at
+	template<typename T>
+	static bool hit_element(const T& p, const ray& r, float t_min, float t_max, hit_record& rec) { return p.T::hit(r, t_min, t_max, rec); }
+	static bool hit_element(hitable *p, const ray& r, float t_min, float t_max, hit_record& rec) { return p->hit(r, t_min, t_max, rec); }
+	template<typename T>
+	static bool occluded_element(const T& p, const ray& r, float t_min, float t_max) { return p.T::occluded(r, t_min, t_max); }
+	static bool occluded_element(hitable *p, const ray& r, float t_min, float t_max) { return p->occluded(r, t_min, t_max); }
+
+	//hit_range() and occluded_range() over one run of a single type T
+	template<typename T>
+	static bool hit_run(const T *array, const primitive_handle *h, int n, const ray& r, float t_min, float& t_max, hit_record& rec)
+	{
+		hit_record temp_rec;
+		bool hit_anything = false;
+		for (int i = 0; i < n; i++)
+		{
+			if (hit_element(array[handle_index(h[i])], r, t_min, t_max, temp_rec))
+			{
+				hit_anything = true;
+				t_max = temp_rec.t;
+				rec = temp_rec;
+				if (h[i] & PRIMITIVE_FLIP)
+					rec.normal = -rec.normal;
+			}
+		}
+		return hit_anything;
+	}
+
+	template<typename T>
+	static bool occluded_run(const T *array, const primitive_handle *h, int n, const ray& r, float t_min, float t_max)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			if (occluded_element(array[handle_index(h[i])], r, t_min, t_max))
+				return true;
+		}
+		return false;
+	}
+
+	template<typename T>
+	static size_t push(std::vector<T>& array, const T& p)
+	{
+		array.push_back(p);
+		return array.size() - 1;
+	}
+
+	//Adds object, already peeled, with to_world baked into a copy of it.
+	//	False, with nothing added, if it isn't a primitive that can be.
+	bool bake(hitable *object, bool flip, const affine_transform& to_world, std::vector<primitive_handle>& handles)
+	{
+		const affine_transform& m = to_world;
+		bool moved_only = m.is_translation();
+		vec3 o = m.offset();
+		if (sphere *s = dynamic_cast<sphere*>(object))
+		{
+			handles.push_back(make_primitive_handle(PRIMITIVE_SPHERE, push(spheres, sphere(m.point(s->center), s->radius, s->mat_ptr)), flip));
+		}
+		else if (xy_rect *xy = dynamic_cast<xy_rect*>(object))
+		{
+			if (moved_only)
+			{
+				xy_rect moved(xy->x0 + o.x(), xy->x1 + o.x(), xy->y0 + o.y(), xy->y1 + o.y(), xy->k + o.z(), xy->mp);
+				handles.push_back(make_primitive_handle(PRIMITIVE_XY_RECT, push(xy_rects, moved), flip));
+			}
+			else
+				add_quad(m, vec3(xy->x0, xy->y0, xy->k), vec3(xy->x1 - xy->x0, 0, 0), vec3(0, xy->y1 - xy->y0, 0), vec3(0, 0, 1), xy->mp, flip, handles);
+		}
+		else if (xz_rect *xz = dynamic_cast<xz_rect*>(object))
+		{
+			if (moved_only)
+			{
+				xz_rect moved(xz->x0 + o.x(), xz->x1 + o.x(), xz->z0 + o.z(), xz->z1 + o.z(), xz->k + o.y(), xz->mp);
+				handles.push_back(make_primitive_handle(PRIMITIVE_XZ_RECT, push(xz_rects, moved), flip));
+			}
+			else
+				add_quad(m, vec3(xz->x0, xz->k, xz->z0), vec3(xz->x1 - xz->x0, 0, 0), vec3(0, 0, xz->z1 - xz->z0), vec3(0, 1, 0), xz->mp, flip, handles);
+		}
+		else if (yz_rect *yz = dynamic_cast<yz_rect*>(object))
+		{
+			if (moved_only)
+			{
+				yz_rect moved(yz->y0 + o.y(), yz->y1 + o.y(), yz->z0 + o.z(), yz->z1 + o.z(), yz->k + o.x(), yz->mp);
+				handles.push_back(make_primitive_handle(PRIMITIVE_YZ_RECT, push(yz_rects, moved), flip));
+			}
+			else
+				add_quad(m, vec3(yz->k, yz->y0, yz->z0), vec3(0, yz->y1 - yz->y0, 0), vec3(0, 0, yz->z1 - yz->z0), vec3(1, 0, 0), yz->mp, flip, handles);
+		}
+		else if (quad *q = dynamic_cast<quad*>(object))
+		{
+			add_quad(m, q->q, q->u, q->v, q->normal, q->mp, flip, handles);
+		}
+		else if (triangle *tri = dynamic_cast<triangle*>(object))
+		{
+			handles.push_back(make_primitive_handle(PRIMITIVE_TRIANGLE, push(triangles, triangle(m.point(tri->v0), m.point(tri->v1), m.point(tri->v2), tri->mat_ptr)), flip));
+		}
+		else if (box *b = dynamic_cast<box*>(object))
+		{
+			for (int i = 1; i >= 0; i--)
+			{
+				bake(&b->xy[i], flip != (i == 0), to_world, handles);
+				bake(&b->xz[i], flip != (i == 0), to_world, handles);
+				bake(&b->yz[i], flip != (i == 0), to_world, handles);
+			}
+		}
+		else
+			return false;
+		return true;
+	}
+
+	void add_quad(const affine_transform& m, const vec3& corner, const vec3& u, const vec3& v, const vec3& normal, material *mat, bool flip, std::vector<primitive_handle>& handles)
+	{
+		quad moved(m.point(corner), m.vector(u), m.vector(v), m.vector(normal), mat);
+		handles.push_back(make_primitive_handle(PRIMITIVE_QUAD, push(quads, moved), flip));
+	}
+};
@@ -24,4 +24,7 @@ public:
 	vec3 B;
 	vec3 INV_B;
 	float B_length;
-};
\ No newline at end of file
+};
+
+//Far end of every ray the integrators trace, past anything in the scenes
+const float RAY_T_MAX = 4000.0f;
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "hitable.h"
+#include "simd.h"
+#include <cfloat>
+
+//Primary rays of a 4x4 pixel block, traced through the BVH together.
+const int RAY_PACKET_DIM = 4;
+const int RAY_PACKET_SIZE = RAY_PACKET_DIM * RAY_PACKET_DIM;
+
+//Keeps interval products finite when a direction component is 0
+const float RAY_PACKET_INV_DIR_LIMIT = 1e30f;
+
+struct ray_packet
+{
+	//Call after filling rays[] (and setting n) to build the SoA copies and
+	//	the origin / inverse direction intervals used for frustum culling.
+	void setup(float t_min_all, float t_max_all)
+	{
+		t_min = t_min_all;
+		coherent = true;
+		for (int a = 0; a < 3; a++)
+		{
+			org_min[a] = inv_min[a] = FLT_MAX;
+			org_max[a] = inv_max[a] = -FLT_MAX;
+		}
+		for (int i = 0; i < RAY_PACKET_SIZE; i++)
+		{
+			//Unused slots repeat the first ray so they never widen the intervals
+			const ray& r = rays[i < n ? i : 0];
+			for (int a = 0; a < 3; a++)
+			{
+				float inv = std::max(-RAY_PACKET_INV_DIR_LIMIT, std::min(RAY_PACKET_INV_DIR_LIMIT, r.InvDir()[a]));
+				org[a][i] = r.origin()[a];
+				inv_dir[a][i] = inv;
+				org_min[a] = std::min(org_min[a], org[a][i]);
+				org_max[a] = std::max(org_max[a], org[a][i]);
+				inv_min[a] = std::min(inv_min[a], inv);
+				inv_max[a] = std::max(inv_max[a], inv);
+			}
+			t_max[i] = i < n ? t_max_all : -FLT_MAX;
+			hit[i] = false;
+		}
+		//Interval culling needs one entry plane per axis for the whole packet
+		for (int a = 0; a < 3; a++)
+		{
+			if (inv_min[a] < 0.0f && inv_max[a] >= 0.0f)
+				coherent = false;
+		}
+	}
+
+	//Bit mask of the rays whose current [t_min, t_max] overlaps the box
+	int box_mask(const float *bmin, const float *bmax) const
+	{
+		int mask = 0;
+		for (int i = 0; i < RAY_PACKET_SIZE; i += SIMD_WIDTH)
+		{
+			vfloat tn = vset1(t_min);
+			vfloat tf = vload(&t_max[i]);
+			for (int a = 0; a < 3; a++)
+			{
+				vfloat o = vload(&org[a][i]);
+				vfloat id = vload(&inv_dir[a][i]);
+				vfloat t0 = vmul(vsub(vset1(bmin[a]), o), id);
+				vfloat t1 = vmul(vsub(vset1(bmax[a]), o), id);
+				tn = vmax(vmin(t0, t1), tn);
+				tf = vmin(vmax(t0, t1), tf);
+			}
+			mask |= vmovemask(vle(tn, tf)) << i;
+		}
+		return mask;
+	}
+
+	float max_t() const
+	{
+		float m = -FLT_MAX;
+		for (int i = 0; i < n; i++)
+			m = std::max(m, t_max[i]);
+		return m;
+	}
+
+	int n;
+	ray rays[RAY_PACKET_SIZE];
+	hit_record recs[RAY_PACKET_SIZE];
+	bool hit[RAY_PACKET_SIZE];
+	alignas(32) float t_max[RAY_PACKET_SIZE];
+	alignas(32) float org[3][RAY_PACKET_SIZE];
+	alignas(32) float inv_dir[3][RAY_PACKET_SIZE];
+	float t_min;
+
+	bool coherent;
+	float org_min[3], org_max[3];
+	float inv_min[3], inv_max[3];
+};
+
+//Lower and upper bound of x * y for x in [x0, x1] and y in [y0, y1]
+inline void interval_mul(vfloat x0, vfloat x1, vfloat y0, vfloat y1, vfloat& lo, vfloat& hi)
+{
+	vfloat a = vmul(x0, y0), b = vmul(x0, y1), c = vmul(x1, y0), d = vmul(x1, y1);
+	lo = vmin(vmin(a, b), vmin(c, d));
+	hi = vmax(vmax(a, b), vmax(c, d));
+}
+
+//Interval arithmetic frustum test of a whole packet against SIMD_WIDTH boxes
+//	stored SoA (rows 0..2 min, 3..5 max). A clear bit means no ray of the packet
+//	can hit that box. t_near receives a lower bound of the entry distance.
+inline int packet_frustum_mask(const ray_packet& p, const float bounds[6][SIMD_WIDTH], float t_max, float *t_near)
+{
+	vfloat tn = vset1(p.t_min);
+	vfloat tf = vset1(t_max);
+	for (int a = 0; a < 3; a++)
+	{
+		bool neg = p.inv_max[a] < 0.0f;
+		vfloat near_plane = vload(bounds[neg ? a + 3 : a]);
+		vfloat far_plane = vload(bounds[neg ? a : a + 3]);
+		vfloat omin = vset1(p.org_min[a]), omax = vset1(p.org_max[a]);
+		vfloat imin = vset1(p.inv_min[a]), imax = vset1(p.inv_max[a]);
+		vfloat lo, hi;
+		interval_mul(vsub(near_plane, omax), vsub(near_plane, omin), imin, imax, lo, hi);
+		tn = vmax(lo, tn);
+		interval_mul(vsub(far_plane, omax), vsub(far_plane, omin), imin, imax, lo, hi);
+		tf = vmin(hi, tf);
+	}
+	vstore(t_near, tn);
+	return vmovemask(vle(tn, tf));
+}
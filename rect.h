@@ -9,12 +9,26 @@ public:
 	xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material *mat) : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
 
 	virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t0, float t1) const;
 	virtual bool bounding_box(aabb& box) const
 	{
 		box = aabb(vec3(x0, y0, k - 0.0001), vec3(x1, y1, k + 0.0001));
 		return true;
 	}
 
+	virtual float pdf_value(const vec3& o, const vec3& v) const
+	{
+		hit_record rec;
+		if (!hit(ray(o, v), 0.001, FLT_MAX, rec))
+			return 0.0f;
+		return area_to_solid_angle_pdf(rec, v, (x1 - x0) * (y1 - y0));
+	}
+
+	virtual vec3 random(const vec3& o) const
+	{
+		return vec3(x0 + random_float() * (x1 - x0), y0 + random_float() * (y1 - y0), k) - o;
+	}
+
 	material *mp;
 	float x0, x1, y0, y1, k;
 };
@@ -39,6 +53,16 @@ bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const
 	return true;
 }
 
+bool xy_rect::occluded(const ray& r, float t0, float t1) const
+{
+	float t = (k - r.origin().z()) * r.InvDir().z();
+	if (t < t0 || t > t1)
+		return false;
+	float x = r.origin().x() + t * r.direction().x();
+	float y = r.origin().y() + t * r.direction().y();
+	return !(x < x0 || x > x1 || y < y0 || y > y1);
+}
+
 class yz_rect : public hitable
 {
 public:
@@ -46,12 +70,26 @@ public:
 	yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material *mat) : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
 	virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t0, float t1) const;
 	virtual bool bounding_box(aabb& box) const
 	{
 		box = aabb(vec3(k - 0.0001, y0, z0), vec3(k + 0.0001, y1, z1));
 		return true;
 	}
 
+	virtual float pdf_value(const vec3& o, const vec3& v) const
+	{
+		hit_record rec;
+		if (!hit(ray(o, v), 0.001, FLT_MAX, rec))
+			return 0.0f;
+		return area_to_solid_angle_pdf(rec, v, (y1 - y0) * (z1 - z0));
+	}
+
+	virtual vec3 random(const vec3& o) const
+	{
+		return vec3(k, y0 + random_float() * (y1 - y0), z0 + random_float() * (z1 - z0)) - o;
+	}
+
 	material *mp;
 	float y0, y1, z0, z1, k;
 };
@@ -76,6 +114,16 @@ bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const
 	return true;
 }
 
+bool yz_rect::occluded(const ray& r, float t0, float t1) const
+{
+	float t = (k - r.origin().x()) * r.InvDir().x();
+	if (t < t0 || t > t1)
+		return false;
+	float y = r.origin().y() + t * r.direction().y();
+	float z = r.origin().z() + t * r.direction().z();
+	return !(y < y0 || y > y1 || z < z0 || z > z1);
+}
+
 class xz_rect : public hitable
 {
 public:
@@ -83,12 +131,26 @@ public:
 	xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material *mat) : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
 
 	virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t0, float t1) const;
 	virtual bool bounding_box(aabb& box) const
 	{
 		box = aabb(vec3(x0, k - 0.0001, z0), vec3(x1, k + 0.0001, z1));
 		return true;
 	}
 
+	virtual float pdf_value(const vec3& o, const vec3& v) const
+	{
+		hit_record rec;
+		if (!hit(ray(o, v), 0.001, FLT_MAX, rec))
+			return 0.0f;
+		return area_to_solid_angle_pdf(rec, v, (x1 - x0) * (z1 - z0));
+	}
+
+	virtual vec3 random(const vec3& o) const
+	{
+		return vec3(x0 + random_float() * (x1 - x0), k, z0 + random_float() * (z1 - z0)) - o;
+	}
+
 	material *mp;
 	float x0, x1, z0, z1, k;
 };
@@ -111,4 +173,100 @@ bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const
 	rec.p = r.point_at_parameter(t);
 	rec.normal = vec3(0, 1, 0);
 	return true;
-}
\ No newline at end of file
+}
+
+bool xz_rect::occluded(const ray& r, float t0, float t1) const
+{
+	float t = (k - r.origin().y()) * r.InvDir().y();
+	if (t < t0 || t > t1)
+		return false;
+	float x = r.origin().x() + t * r.direction().x();
+	float z = r.origin().z() + t * r.direction().z();
+	return !(x < x0 || x > x1 || z < z0 || z > z1);
+}
+
+//Parallelogram q + a * u + b * v, a and b in [0, 1], in any orientation:
+//	what an axis-aligned rect becomes once a rotation is baked into it.
+//	Two-sided like the rects, with the normal given rather than derived
+//	from u and v, so it keeps the side the rect's normal was on.
+class quad : public hitable
+{
+public:
+	quad() {}
+	quad(const vec3& corner, const vec3& edge_u, const vec3& edge_v, const vec3& n, material *mat)
+		: q(corner), u(edge_u), v(edge_v), normal(n), mp(mat)
+	{
+		vec3 c = cross(u, v);
+		plane_normal = unit_vector(c);
+		d = dot(plane_normal, q);
+		w = c / dot(c, c);
+		area = c.length();
+	}
+
+	virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t0, float t1) const
+	{
+		float t;
+		return intersect(r, t0, t1, t);
+	}
+	virtual bool bounding_box(aabb& box) const
+	{
+		vec3 corners[3] = { q + u, q + v, q + u + v };
+		vec3 lo = q, hi = q;
+		for (int i = 0; i < 3; i++)
+		{
+			lo = vec3(ffmin(lo.x(), corners[i].x()), ffmin(lo.y(), corners[i].y()), ffmin(lo.z(), corners[i].z()));
+			hi = vec3(ffmax(hi.x(), corners[i].x()), ffmax(hi.y(), corners[i].y()), ffmax(hi.z(), corners[i].z()));
+		}
+		//Padded like the rects, a quad in an axis plane has no thickness
+		box = aabb(lo - vec3(0.0001f, 0.0001f, 0.0001f), hi + vec3(0.0001f, 0.0001f, 0.0001f));
+		return true;
+	}
+
+	virtual float pdf_value(const vec3& o, const vec3& dir) const
+	{
+		hit_record rec;
+		if (!hit(ray(o, dir), 0.001, FLT_MAX, rec))
+			return 0.0f;
+		return area_to_solid_angle_pdf(rec, dir, area);
+	}
+
+	virtual vec3 random(const vec3& o) const
+	{
+		return q + random_float() * u + random_float() * v - o;
+	}
+
+	bool intersect(const ray& r, float t0, float t1, float& t) const;
+
+	vec3 q, u, v;
+	vec3 normal; //reported on hits
+	vec3 plane_normal, w; //unit normal of u x v, and (u x v) / |u x v|^2 for the coordinates
+	float d, area;
+	material *mp;
+};
+
+bool quad::intersect(const ray& r, float t0, float t1, float& t) const
+{
+	float denom = dot(plane_normal, r.direction());
+	if (fabs(denom) < 1e-8f)
+		return false;
+	t = (d - dot(plane_normal, r.origin())) / denom;
+	if (t < t0 || t > t1)
+		return false;
+	vec3 planar = r.point_at_parameter(t) - q;
+	float a = dot(w, cross(planar, v));
+	float b = dot(w, cross(u, planar));
+	return a >= 0.0f && a <= 1.0f && b >= 0.0f && b <= 1.0f;
+}
+
+bool quad::hit(const ray& r, float t0, float t1, hit_record& rec) const
+{
+	float t;
+	if (!intersect(r, t0, t1, t))
+		return false;
+	rec.t = t;
+	rec.mat_ptr = mp;
+	rec.p = r.point_at_parameter(t);
+	rec.normal = normal;
+	return true;
+}
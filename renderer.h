@@ -0,0 +1,798 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include "ray.h"
+#include "sphere.h"
+#include "hitablelist.h"
+#include "camera.h"
+#include "material.h"
+#include <stdlib.h>
+#include <cstring>
+#include <limits>
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+#include "ray_packet.h"
+#include "wavefront.h"
+#include "scheduler.h"
+#include "image_io.h"
+#include "scene_loader.h"
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "rect.h"
+#include "box.h"
+#include "triangle.h"
+#include "rotate.h"
+#include "instance.h"
+
+#include <cfloat>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef unsigned int uint;
+
+//Acceleration structure built over the scene.
+//	bvh_node is the pointer based reference, linear_bvh the flattened one
+//	and wide_bvh tests 4 (SSE) or 8 (AVX2) children at once.
+enum accel_type
+{
+	ACCEL_BVH_NODE,
+	ACCEL_LINEAR_BVH,
+	ACCEL_WIDE_BVH
+};
+
+const accel_type ACCEL = ACCEL_WIDE_BVH;
+
+//Trace primary rays as 4x4 packets when the scene root is a wide_bvh
+const bool PACKET_PRIMARY_RAYS = true;
+
+//Path tracing with color() per sample, or the wavefront integrator that advances all
+//	paths of a tile stage by stage. Selected with --wavefront.
+enum integrator_type
+{
+	INTEGRATOR_PATH,
+	INTEGRATOR_WAVEFRONT
+};
+
+//Adaptive sampling (--adaptive) spends on average --spp samples per pixel,
+//	where they are needed most. A first pass gives every pixel min_samples,
+//	then passes of ADAPTIVE_BATCH more go to the blocks whose standard
+//	error of the mean luminance is still above adaptive_threshold times
+//	that mean, up to max_samples, until the frame's budget is spent or
+//	every block has converged. The mean is clamped to white for the
+//	tolerance: brighter displays as white anyway, and a block on a light's
+//	edge would otherwise be allowed a large error and stop early.
+//	The wavefront integrator always takes samples.
+const uint ADAPTIVE_BATCH = 8;
+const float ADAPTIVE_MIN_LUMINANCE = 0.01f; //keeps dark pixels from never converging
+const float ADAPTIVE_MAX_LUMINANCE = 1.0f;
+
+//Everything a front end can set from the command line, see parse_options()
+struct render_options
+{
+	uint width = 1024;
+	uint height = 512;
+	uint samples = 64; //per pixel
+	uint pass_samples = 0; //per pixel and progressive pass, 0 renders every tile in one go
+	uint tile_size = 32; //need not divide width or height
+	uint min_tile = 8; //smallest sub-tile the scheduler splits tiles into
+	uint threads = 0; //render threads including the main one, 0 for one per core
+	string scene = "scenes/cornell_triangle.scene";
+	string output = "output.ppm";
+	bool use_cache = true; //map the scene's meshes from <scene>.cache
+
+	integrator_type integrator = INTEGRATOR_PATH;
+	bool adaptive = false;
+	uint min_samples = 0; //0 for samples / 4
+	uint max_samples = 0; //0 for 2 * samples
+	float adaptive_threshold = 0.2f;
+
+	//Paths end after max_depth bounces and Russian roulette starts at bounce rr_min_depth
+	int max_depth = 50;
+	int rr_min_depth = 3;
+};
+
+render_options options;
+
+//Owns everything world and lights point to, loaded by render_setup() and
+//	freed all at once by render_teardown()
+scene_description scene;
+hitable *world;
+hitable *lights; //emitters sampled by next event estimation, NULL for none
+wide_bvh *packet_world; //world, if it can trace ray packets
+
+camera cam; //set up by render_setup() once the image size is known
+
+atomic<unsigned> done_count;
+
+//Prototypes
+vec3 color(const ray& r, hitable *world);
+vec3 shade(const ray& r, const hit_record& rec, hitable *world);
+vec3 sample_lights(const ray& r, const hit_record& rec, hitable *world);
+hitable *build_accel(hitable **list, int n, arena& memory);
+
+inline float luminance(const vec3& c)
+{
+	return 0.2126f * c.r() + 0.7152f * c.g() + 0.0722f * c.b();
+}
+
+//Running estimate of one pixel: the sum of its samples and of their squared
+//	luminance, enough for the variance of the mean.
+struct pixel_estimate
+{
+	pixel_estimate() : sum(0.0f, 0.0f, 0.0f), lum_sq(0.0f), n(0) {}
+
+	void add(const vec3& c)
+	{
+		float l = luminance(c);
+		sum += c;
+		lum_sq += l * l;
+		n++;
+	}
+
+	float variance_of_mean() const
+	{
+		if (n < 2)
+			return FLT_MAX;
+		float mean = luminance(sum) / n;
+		float variance = max(0.0f, (lum_sq - n * mean * mean) / (n - 1));
+		return variance / n;
+	}
+
+	vec3 sum;
+	float lum_sq;
+	uint n;
+};
+
+//Side of the square cells ImageData tracks changes in for the preview
+const uint DIRTY_CELL = 16;
+
+struct ImageData
+{
+public:
+	ImageData() : _width(0), _height(0), data(NULL), lum_sq(NULL), counts(NULL) {}
+
+	ImageData(uint w, uint h) : data(NULL), lum_sq(NULL), counts(NULL)
+	{
+		reset(w, h);
+	}
+
+	//Reallocates for a w x h image without samples, all black.
+	//	Samples accumulate from there, pass after pass.
+	void reset(uint w, uint h)
+	{
+		release();
+		_width = w;
+		_height = h;
+		data = new float[_width * _height * 3]; //R, G and B planes
+		lum_sq = new float[_width * _height];
+		counts = new uint[_width * _height];
+		memset(data, 0, sizeof(float) * _width * _height * 3);
+		memset(lum_sq, 0, sizeof(float) * _width * _height);
+		memset(counts, 0, sizeof(uint) * _width * _height);
+
+		//Everything is dirty so the first preview clears the whole texture
+		cells_x = (_width + DIRTY_CELL - 1) / DIRTY_CELL;
+		cells_y = (_height + DIRTY_CELL - 1) / DIRTY_CELL;
+		dirty = vector<atomic<uint8_t>>(cells_x * cells_y);
+		markDirty(0, 0, _width, _height);
+	}
+
+	//Marks the pixels of a finished tile for the next updatePreview()
+	void markDirty(uint x, uint y, uint w, uint h)
+	{
+		for (uint cy = y / DIRTY_CELL; cy <= (y + h - 1) / DIRTY_CELL; cy++)
+			for (uint cx = x / DIRTY_CELL; cx <= (x + w - 1) / DIRTY_CELL; cx++)
+				dirty[cy * cells_x + cx].store(1, memory_order_release);
+	}
+
+	//Converts what changed since the last call to 8-bit RGBA and hands it to
+	//	upload(rgba, x, y, w, h) one rectangle at a time, in display
+	//	coordinates (top row first) and tightly packed. Runs of dirty cells
+	//	along a row of cells go up as one rectangle, so the cost follows the
+	//	tiles finished, not the resolution.
+	template<typename F>
+	void updatePreview(F upload)
+	{
+		for (uint cy = 0; cy < cells_y; cy++)
+		{
+			for (uint cx = 0; cx < cells_x; cx++)
+			{
+				if (!dirty[cy * cells_x + cx].exchange(0, memory_order_acquire))
+					continue;
+				uint run = 1;
+				while (cx + run < cells_x && dirty[cy * cells_x + cx + run].exchange(0, memory_order_acquire))
+					run++;
+
+				uint x0 = cx * DIRTY_CELL, y0 = cy * DIRTY_CELL;
+				uint w = min(run * DIRTY_CELL, _width - x0), h = min(DIRTY_CELL, _height - y0);
+				preview.resize(w * h * 4);
+				for (uint y = y0; y < y0 + h; y++)
+				{
+					uint i = y * _width + x0;
+					uint8_t *row = &preview[(y0 + h - 1 - y) * w * 4];
+					tonemap_rgba(data + i, data + plane() + i, data + 2 * plane() + i, counts + i, w, row);
+				}
+				upload(preview.data(), x0, _height - y0 - h, w, h);
+				cx += run - 1;
+			}
+		}
+	}
+
+	//Mean of every pixel's samples, for the image writers
+	image_buffer resolve() const
+	{
+		image_buffer img(_width, _height);
+		for (uint y = 0; y < _height; y++)
+		{
+			float *row = &img.rgb[(_height - y - 1) * _width * 3];
+			for (uint x = 0; x < _width; x++)
+			{
+				uint i = y * _width + x;
+				float inv_n = 1.0f / max(counts[i], 1u);
+				for (int c = 0; c < 3; c++)
+					row[x * 3 + c] = data[c * plane() + i] * inv_n;
+			}
+		}
+		return img;
+	}
+
+	//Adds n samples that sum to pixColor. Their luminance is not tracked.
+	inline void addSamples(uint x, uint y, const vec3 &pixColor, uint n)
+	{
+		uint i = y * _width + x;
+		data[i] += pixColor.r();
+		data[plane() + i] += pixColor.g();
+		data[2 * plane() + i] += pixColor.b();
+		counts[i] += n;
+	}
+
+	//Everything accumulated so far, to continue with setPixel()
+	inline pixel_estimate getEstimate(uint x, uint y) const
+	{
+		uint i = y * _width + x;
+		pixel_estimate estimate;
+		estimate.sum = vec3(data[i], data[plane() + i], data[2 * plane() + i]);
+		estimate.lum_sq = lum_sq[i];
+		estimate.n = counts[i];
+		return estimate;
+	}
+
+	inline void setPixel(uint x, uint y, const pixel_estimate &estimate)
+	{
+		uint i = y * _width + x;
+		data[i] = estimate.sum.r();
+		data[plane() + i] = estimate.sum.g();
+		data[2 * plane() + i] = estimate.sum.b();
+		lum_sq[i] = estimate.lum_sq;
+		counts[i] = estimate.n;
+	}
+
+	uint sampleCount(uint x, uint y) const { return counts[y * _width + x]; }
+
+	uint64_t totalSamples() const
+	{
+		uint64_t total = 0;
+		for (uint i = 0; i < _width * _height; i++)
+			total += counts[i];
+		return total;
+	}
+
+	uint width() const { return _width; }
+	uint height() const { return _height; }
+
+	~ImageData()
+	{
+		release();
+	}
+
+private:
+	uint plane() const { return _width * _height; }
+
+	void release()
+	{
+		delete[] data;
+		delete[] lum_sq;
+		delete[] counts;
+	}
+
+	uint _width;
+	uint _height;
+	float* data;
+	float* lum_sq; //sum of squared sample luminance
+	uint* counts; //samples taken
+	uint cells_x, cells_y;
+	vector<atomic<uint8_t>> dirty; //per DIRTY_CELL cell, changed since the last preview
+	vector<uint8_t> preview; //RGBA of the rectangle being uploaded
+};
+
+ImageData renderImage;
+
+tile_scheduler scheduler;
+
+//Samples the frame may take in all, summed over its pixels, and taken so
+//	far. Only adaptive sampling stops on it, the other modes take exactly
+//	--spp per pixel.
+uint64_t sample_budget;
+atomic<uint64_t> samples_spent;
+
+inline bool adaptive_frame()
+{
+	return options.adaptive && options.integrator != INTEGRATOR_WAVEFRONT;
+}
+
+//Samples per pixel of the whole frame, the most adaptive sampling may take
+inline uint frame_samples()
+{
+	return adaptive_frame() ? options.max_samples : options.samples;
+}
+
+//Progressive rendering (--progressive) spreads the frame's samples over
+//	passes of pass_samples each, the last one taking what is left. Every
+//	pass covers the whole image, so the preview sharpens everywhere at once.
+//	Adaptive sampling always renders in passes: min_samples, then steps of
+//	pass_samples, or ADAPTIVE_BATCH without --progressive.
+inline uint pass_step()
+{
+	return options.pass_samples ? options.pass_samples : ADAPTIVE_BATCH;
+}
+
+inline int pass_count()
+{
+	if (adaptive_frame())
+		return 1 + int((options.max_samples - min(options.min_samples, options.max_samples) + pass_step() - 1) / pass_step());
+	return options.pass_samples ? int((frame_samples() + options.pass_samples - 1) / options.pass_samples) : 1;
+}
+
+inline uint samples_in_pass(int pass)
+{
+	if (adaptive_frame())
+		return pass == 0 ? min(options.min_samples, options.max_samples) : min(pass_step(), options.max_samples - options.min_samples - (pass - 1) * pass_step());
+	return options.pass_samples ? min(options.pass_samples, frame_samples() - pass * options.pass_samples) : frame_samples();
+}
+
+struct Task
+{
+public:
+	Task() : wavefront(options.max_depth, options.rr_min_depth), _id(num++) { cout << "Thread " << _id << " created!" << endl; }
+
+	//Renders the next tile of the frame, false once there is none left
+	bool runTile()
+	{
+		if (!scheduler.next(_id, current))
+			return false;
+		budget = samples_in_pass(scheduler.pass());
+
+		if (options.integrator == INTEGRATOR_WAVEFRONT)
+			renderWavefront();
+		else if (options.adaptive || (PACKET_PRIMARY_RAYS && packet_world))
+			renderBlocks();
+		else
+			renderPixels();
+
+		renderImage.markDirty(current.x, current.y, current.w, current.h);
+		scheduler.finish(_id);
+		return true;
+	}
+
+	void run()
+	{
+		while (runTile())
+			;
+
+		done_count++;
+
+		cout << "Thread " << _id << " is done!" << endl;
+	}
+
+	void renderPixels()
+	{
+		sampler& smp = thread_sampler();
+		for (int y = current.y; y < current.y + current.h; y++)
+		{
+			for (int x = current.x; x < current.x + current.w; x++)
+			{
+				vec3 pixColor(0.0f, 0.0f, 0.0f);
+				for (uint s = 0; s < budget; s++)
+				{
+					float jx, jy;
+					smp.next_2d(jx, jy);
+					float u = float(x + jx) / float(options.width);
+					float v = float(y + jy) / float(options.height);
+					ray r = cam.get_ray(u, v);
+					pixColor += color(r, world);
+				}
+				renderImage.addSamples(x, y, pixColor, budget);
+			}
+		}
+	}
+
+	void renderBlocks()
+	{
+		for (int y = current.y; y < current.y + current.h; y += RAY_PACKET_DIM)
+			for (int x = current.x; x < current.x + current.w; x += RAY_PACKET_DIM)
+				renderBlock(x, y);
+	}
+
+	//Adaptive sampling decides per block: the block stops once the mean
+	//	variance of its pixel estimates is within the threshold of its mean
+	//	luminance. Pooling the block makes the variance estimate reliable;
+	//	single pixels that have not seen the light yet look converged.
+	bool converged(const pixel_estimate *estimate, const bool *outside)
+	{
+		float mean = 0.0f, variance = 0.0f;
+		int n = 0;
+		for (int i = 0; i < RAY_PACKET_SIZE; i++)
+		{
+			if (outside[i])
+				continue;
+			mean += luminance(estimate[i].sum) / estimate[i].n;
+			variance += estimate[i].variance_of_mean();
+			n++;
+		}
+		float tolerance = options.adaptive_threshold * min(max(mean / n, ADAPTIVE_MIN_LUMINANCE), ADAPTIVE_MAX_LUMINANCE);
+		return variance / n <= tolerance * tolerance;
+	}
+
+	//Adds up to budget samples to a RAY_PACKET_DIM x RAY_PACKET_DIM block,
+	//	fewer once it has converged. With packet_world the primary rays of
+	//	every sample are traced as one packet, the bounces after that are
+	//	traced one ray at a time by shade().
+	void renderBlock(uint bx, uint by)
+	{
+		pixel_estimate estimate[RAY_PACKET_SIZE];
+		bool outside[RAY_PACKET_SIZE];
+		uint taken = 0; //by every pixel of the block in earlier passes
+		uint inside = 0;
+		for (int i = 0; i < RAY_PACKET_SIZE; i++)
+		{
+			//Clipped to the tile, which lies within the image: tiles needn't be
+			//	multiples of the block size, and a block spilling into the
+			//	next tile would render its pixels twice, from two threads
+			outside[i] = int(bx + i % RAY_PACKET_DIM) >= current.x + current.w || int(by + i / RAY_PACKET_DIM) >= current.y + current.h;
+			if (!outside[i])
+			{
+				estimate[i] = renderImage.getEstimate(bx + i % RAY_PACKET_DIM, by + i / RAY_PACKET_DIM);
+				taken = estimate[i].n;
+				inside++;
+			}
+		}
+		if (options.adaptive && taken >= options.min_samples
+			&& (samples_spent.load(memory_order_relaxed) >= sample_budget || converged(estimate, outside)))
+			return;
+
+		sampler& smp = thread_sampler();
+		ray_packet packet;
+		int active[RAY_PACKET_SIZE];
+		uint s = 0;
+		for (; s < budget; s++)
+		{
+			packet.n = 0;
+			for (int i = 0; i < RAY_PACKET_SIZE; i++)
+			{
+				if (outside[i])
+					continue;
+				float jx, jy;
+				smp.next_2d(jx, jy);
+				float u = float(bx + i % RAY_PACKET_DIM + jx) / float(options.width);
+				float v = float(by + i / RAY_PACKET_DIM + jy) / float(options.height);
+				active[packet.n] = i;
+				packet.rays[packet.n++] = cam.get_ray(u, v);
+			}
+			if (packet.n == 0)
+				break;
+			if (PACKET_PRIMARY_RAYS && packet_world)
+			{
+				packet.setup(0.001, RAY_T_MAX);
+				packet_world->hit_packet(packet);
+				for (int j = 0; j < packet.n; j++)
+					estimate[active[j]].add(packet.hit[j] ? shade(packet.rays[j], packet.recs[j], world) : vec3(0.0f, 0.0f, 0.0f));
+			}
+			else
+			{
+				for (int j = 0; j < packet.n; j++)
+					estimate[active[j]].add(color(packet.rays[j], world));
+			}
+
+			uint n = taken + s + 1;
+			if (options.adaptive && n >= options.min_samples && n % ADAPTIVE_BATCH == 0 && converged(estimate, outside))
+			{
+				s++;
+				break;
+			}
+		}
+		samples_spent.fetch_add(uint64_t(s) * inside, memory_order_relaxed);
+
+		for (int i = 0; i < RAY_PACKET_SIZE; i++)
+		{
+			if (!outside[i])
+				renderImage.setPixel(bx + i % RAY_PACKET_DIM, by + i / RAY_PACKET_DIM, estimate[i]);
+		}
+	}
+
+	void renderWavefront()
+	{
+		int w = current.w, h = current.h;
+		tileColor.resize(w * h);
+		wavefront.render_tile(world, cam, current.x, current.y, w, h, options.width, options.height, budget, tileColor.data());
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++)
+				renderImage.addSamples(current.x + x, current.y + y, tileColor[y * w + x], budget);
+	}
+
+private:
+	wavefront_integrator wavefront;
+	vector<vec3> tileColor;
+	tile current;
+	uint budget; //samples per pixel for the current tile
+	int _id;
+	static int num;
+};
+
+int Task::num = 0;
+
+vec3 color(const ray& r, hitable *world)
+{
+	hit_record rec;
+	if (world->hit(r, 0.001, RAY_T_MAX, rec))
+	{
+		return shade(r, rec, world);
+	}
+	else
+	{
+		return vec3(0.0, 0.0, 0.0);//Background
+	}
+}
+
+//Power heuristic weight of a sample from the strategy with density pdf_a
+//	when pdf_b could also have produced it
+inline float mis_weight(float pdf_a, float pdf_b)
+{
+	float a = pdf_a * pdf_a, b = pdf_b * pdf_b;
+	return a / (a + b);
+}
+
+//Radiance leaving the first hit rec back along r, following the path in a
+//	loop with the product of the attenuations so far in throughput.
+//	Diffuse vertices sample a light directly (next event estimation) and
+//	continue with the BSDF sample; light reached both ways is combined with
+//	multiple importance sampling. From options.rr_min_depth on, Russian roulette
+//	ends the path with probability 1 - q and divides the survivors by q,
+//	so dim paths stop early without biasing the estimate.
+vec3 shade(const ray& r_in, const hit_record& rec_in, hitable *world)
+{
+	vec3 radiance(0.0f, 0.0f, 0.0f);
+	vec3 throughput(1.0f, 1.0f, 1.0f);
+	ray r = r_in;
+	hit_record rec = rec_in;
+	float bsdf_pdf = 0.0f; //density the previous diffuse vertex sampled r with, 0 for camera, mirror and glass
+	for (int depth = 0; ; depth++)
+	{
+		vec3 emitted = rec.mat_ptr->emitted();
+		if (lights && bsdf_pdf > 0.0f)
+			emitted *= mis_weight(bsdf_pdf, lights->pdf_value(r.origin(), r.direction()));
+		radiance += throughput * emitted;
+
+		ray scattered;
+		vec3 attenuation;
+		if (depth >= options.max_depth || !rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+			break;
+
+		bsdf_pdf = 0.0f;
+		if (lights && rec.mat_ptr->is_diffuse())
+		{
+			radiance += throughput * attenuation * sample_lights(r, rec, world);
+			bsdf_pdf = rec.mat_ptr->scattering_pdf(r, rec, scattered);
+		}
+		throughput *= attenuation;
+
+		if (depth >= options.rr_min_depth)
+		{
+			float q = min(max(throughput.r(), max(throughput.g(), throughput.b())), 0.95f);
+			if (random_float() >= q)
+				break;
+			throughput /= q;
+		}
+
+		r = scattered;
+		if (!world->hit(r, 0.001, RAY_T_MAX, rec))
+			break; //Background is black
+	}
+	return radiance;
+}
+
+//Light arriving at the diffuse vertex rec from one sampled point on the
+//	lights, weighted against BSDF sampling. Still to be multiplied by the
+//	attenuation of rec's material.
+vec3 sample_lights(const ray& r, const hit_record& rec, hitable *world)
+{
+	ray to_light(rec.p, lights->random(rec.p));
+	float light_pdf = lights->pdf_value(to_light.origin(), to_light.direction());
+	float bsdf_pdf = rec.mat_ptr->scattering_pdf(r, rec, to_light);
+	if (light_pdf <= 0.0f || bsdf_pdf <= 0.0f)
+		return vec3(0.0f, 0.0f, 0.0f);
+
+	//Shadow ray up to just short of the light point
+	hit_record light_rec;
+	if (!lights->hit(to_light, 0.001, RAY_T_MAX, light_rec) || world->occluded(to_light, 0.001, light_rec.t * 0.999f))
+		return vec3(0.0f, 0.0f, 0.0f);
+	return light_rec.mat_ptr->emitted() * (bsdf_pdf / light_pdf * mis_weight(light_pdf, bsdf_pdf));
+}
+
+hitable *build_accel(hitable **list, int n, arena& memory)
+{
+	if (ACCEL == ACCEL_WIDE_BVH)
+		return memory.create<wide_bvh>(list, n);
+	else if (ACCEL == ACCEL_LINEAR_BVH)
+		return memory.create<linear_bvh>(list, n);
+	else
+		return memory.create<bvh_node>(list, n, BVH_MEDIUM, &memory);
+}
+
+void print_usage(const char *program)
+{
+	cout << "Usage: " << program << " [options]\n"
+		<< "  --width N, --height N   image size (1024 x 512)\n"
+		<< "  --spp N                 samples per pixel (64)\n"
+		<< "  --progressive N         render the frame in passes of N samples per pixel\n"
+		<< "  --threads N             render threads, 0 for one per core (0)\n"
+		<< "  --tile N                tile size in pixels (32)\n"
+		<< "  --min-tile N            smallest tile the scheduler splits down to (8)\n"
+		<< "  --scene FILE            scene description (scenes/cornell_triangle.scene)\n"
+		<< "  --output FILE           image to write, .ppm, .png, .pfm or .exr (output.ppm)\n"
+		<< "  --no-cache              build the meshes instead of using or writing SCENE.cache\n"
+		<< "  --wavefront             wavefront integrator instead of path tracing\n"
+		<< "  --adaptive              adaptive sampling averaging --spp, with --min-spp (spp / 4),\n"
+		<< "                          --max-spp (2 spp) and --threshold (0.2)\n"
+		<< "  --max-depth N           longest path (50)\n"
+		<< "  --rr-depth N            bounce Russian roulette starts at (3)\n";
+}
+
+//Fills options from the command line, false (after printing the usage) on
+//	an unknown or incomplete option or --help
+bool parse_options(int argc, char **argv, render_options& o)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (strcmp(arg, "--wavefront") == 0)
+			o.integrator = INTEGRATOR_WAVEFRONT;
+		else if (strcmp(arg, "--adaptive") == 0)
+			o.adaptive = true;
+		else if (strcmp(arg, "--no-cache") == 0)
+			o.use_cache = false;
+		else if (strcmp(arg, "--width") == 0 && has_value)
+			o.width = max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "--height") == 0 && has_value)
+			o.height = max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "--spp") == 0 && has_value)
+			o.samples = max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "--progressive") == 0 && has_value)
+			o.pass_samples = max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "--threads") == 0 && has_value)
+			o.threads = max(0, atoi(argv[++i]));
+		else if (strcmp(arg, "--tile") == 0 && has_value)
+			o.tile_size = max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "--min-tile") == 0 && has_value)
+			o.min_tile = max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "--scene") == 0 && has_value)
+			o.scene = argv[++i];
+		else if (strcmp(arg, "--output") == 0 && has_value)
+			o.output = argv[++i];
+		else if (strcmp(arg, "--min-spp") == 0 && has_value)
+			o.min_samples = max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "--max-spp") == 0 && has_value)
+			o.max_samples = max(1, atoi(argv[++i]));
+		else if (strcmp(arg, "--threshold") == 0 && has_value)
+			o.adaptive_threshold = float(atof(argv[++i]));
+		else if (strcmp(arg, "--max-depth") == 0 && has_value)
+			o.max_depth = max(0, atoi(argv[++i]));
+		else if (strcmp(arg, "--rr-depth") == 0 && has_value)
+			o.rr_min_depth = max(0, atoi(argv[++i]));
+		else
+		{
+			if (strcmp(arg, "--help") != 0)
+				cerr << "Unknown or incomplete option " << arg << endl;
+			print_usage(argv[0]);
+			return false;
+		}
+	}
+	//The scheduler packs tile coordinates into 16 bits
+	if (o.width > 65535 || o.height > 65535)
+	{
+		cerr << "Image size is limited to 65535 x 65535" << endl;
+		return false;
+	}
+	if (o.min_samples == 0)
+		o.min_samples = max(1u, o.samples / 4);
+	if (o.max_samples == 0)
+		o.max_samples = 2 * o.samples;
+	if (o.threads == 0)
+		o.threads = max(1u, thread::hardware_concurrency());
+	return true;
+}
+
+//Frees the scene and everything built over it
+void render_teardown()
+{
+	world = lights = NULL;
+	packet_world = NULL;
+	scene.clear();
+}
+
+//Loads the scene and builds its acceleration structure, then sizes the
+//	camera, the image and the tile scheduler for options. False if the scene
+//	doesn't load. Replaces the scene of an earlier call.
+bool render_setup()
+{
+	render_teardown();
+	cout << "Integrator: " << (options.integrator == INTEGRATOR_WAVEFRONT ? "wavefront" : "path") << endl;
+	if (options.pass_samples)
+		cout << "Progressive: " << pass_count() << " passes of up to " << options.pass_samples << " spp" << endl;
+	if (options.adaptive)
+		cout << "Adaptive sampling: " << options.min_samples << " to " << options.max_samples << " spp, threshold " << options.adaptive_threshold << endl;
+
+	chrono::high_resolution_clock::time_point load_start = chrono::high_resolution_clock::now();
+	if (!load_scene(options.scene, scene, options.use_cache))
+		return false;
+	chrono::high_resolution_clock::time_point build_start = chrono::high_resolution_clock::now();
+	//One matrix per object instead of a chain of wrappers. The wide BVH's
+	//	primitive_store collapses the chains itself and bakes what it can,
+	//	instances made here would stay instances there.
+	if (ACCEL != ACCEL_WIDE_BVH)
+	{
+		for (hitable *&o : scene.objects)
+			o = flatten_transforms(o, scene.memory);
+	}
+	for (hitable *&o : scene.lights)
+		o = flatten_transforms(o, scene.memory);
+	world = build_accel(scene.objects.data(), int(scene.objects.size()), scene.memory);
+	if (scene.lights.empty())
+		lights = NULL;
+	else if (scene.lights.size() == 1)
+		lights = scene.lights[0];
+	else
+	{
+		hitable **list = scene.memory.create_array<hitable*>(scene.lights.size());
+		copy(scene.lights.begin(), scene.lights.end(), list);
+		lights = scene.memory.create<hitable_list>(list, int(scene.lights.size()));
+	}
+	chrono::high_resolution_clock::time_point build_end = chrono::high_resolution_clock::now();
+	packet_world = dynamic_cast<wide_bvh*>(world);
+
+	double load_ms = chrono::duration<double, milli>(build_start - load_start).count();
+	double build_ms = chrono::duration<double, milli>(build_end - build_start).count();
+	cout << "Scene " << options.scene << ": " << scene.objects.size() << " objects, " << scene.lights.size() << " lights, " << scene.n_triangles << " mesh triangles" << endl;
+	if (scene.n_instances)
+		cout << scene.n_instances << " instances of " << scene.definitions.size() << " objects" << endl;
+	cout << "Parsed in " << load_ms - scene.mesh_build_ms << "ms, built BVHs in " << scene.mesh_build_ms + build_ms << "ms (meshes and objects " << scene.mesh_build_ms << "ms, top level " << build_ms << "ms)" << endl;
+	cout << "Scene memory: " << scene.memory.bytes_used() / 1024 << " KB in " << scene.memory.bytes_reserved() / 1024 << " KB of arena blocks" << endl;
+	if (scene.cached_meshes)
+		cout << scene.cached_meshes << " of " << scene.meshes.size() << " meshes mapped from " << options.scene << ".cache" << endl;
+	if (bvh_node *root = dynamic_cast<bvh_node*>(world))
+		cout << "BVH SAH cost: " << root->sah_cost() << endl;
+	else if (linear_bvh *root = dynamic_cast<linear_bvh*>(world))
+		cout << "BVH SAH cost: " << root->sah_cost() << " (" << root->nodes.size() << " nodes)" << endl;
+	else if (wide_bvh *root = dynamic_cast<wide_bvh*>(world))
+	{
+		const primitive_store& p = root->store;
+		cout << "Wide BVH: " << root->nodes.size() << " nodes of " << WIDE_BVH_WIDTH << " children" << endl;
+		cout << "Primitives: " << p.spheres.size() << " spheres, " << p.xy_rects.size() + p.xz_rects.size() + p.yz_rects.size() << " rects, "
+			<< p.quads.size() << " quads, " << p.triangles.size() << " triangles, " << p.instances.size() << " instances, " << p.hitables.size() << " other" << endl;
+	}
+
+	const scene_camera& c = scene.camera;
+	cam = camera(c.lookfrom, c.lookat, c.vup, c.vfov, float(options.width) / float(options.height), c.aperture, c.focus_dist);
+	renderImage.reset(options.width, options.height);
+	scheduler.reset(options.width, options.height, options.tile_size, options.min_tile, options.threads, pass_count());
+	sample_budget = uint64_t(options.samples) * options.width * options.height;
+	samples_spent = 0;
+	done_count = 0;
+	return true;
+}
@@ -1,18 +1,26 @@
 #pragma once
 
 #include "hitable.h"
+#include <cfloat>
 
 class rotate_y : public hitable
 {
 public:
 	rotate_y(hitable *p, float angle);
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return ptr->occluded(rotate_ray(r), t_min, t_max);
+	}
 	virtual bool bounding_box(aabb& box) const
 	{
 		box = bbox;
 		return hasbox;
 	}
 
+	//The ray in the object's unrotated frame
+	ray rotate_ray(const ray& r) const;
+
 	hitable *ptr;
 	float sin_theta;
 	float cos_theta;
@@ -53,7 +61,7 @@ rotate_y::rotate_y(hitable *p, float angle) : ptr(p)
 	bbox = aabb(min, max);
 }
 
-bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+ray rotate_y::rotate_ray(const ray& r) const
 {
 	vec3 origin = r.origin();
 	vec3 direction = r.direction();
@@ -61,7 +69,12 @@ bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
 	direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
 	direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-	ray rotated_r(origin, direction);
+	return ray(origin, direction);
+}
+
+bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	ray rotated_r = rotate_ray(r);
 	if (ptr->hit(rotated_r, t_min, t_max, rec))
 	{
 		vec3 p = rec.p;
@@ -83,12 +96,19 @@ class rotate_z : public hitable
 public:
 	rotate_z(hitable *p, float angle);
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return ptr->occluded(rotate_ray(r), t_min, t_max);
+	}
 	virtual bool bounding_box(aabb& box) const
 	{
 		box = bbox;
 		return hasbox;
 	}
 
+	//The ray in the object's unrotated frame
+	ray rotate_ray(const ray& r) const;
+
 	hitable *ptr;
 	float sin_theta;
 	float cos_theta;
@@ -129,7 +149,7 @@ rotate_z::rotate_z(hitable *p, float angle) : ptr(p)
 	bbox = aabb(min, max);
 }
 
-bool rotate_z::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+ray rotate_z::rotate_ray(const ray& r) const
 {
 	vec3 origin = r.origin();
 	vec3 direction = r.direction();
@@ -137,7 +157,12 @@ bool rotate_z::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	origin[1] = -sin_theta * r.origin()[0] + cos_theta * r.origin()[1];
 	direction[0] = cos_theta * r.direction()[0] + sin_theta * r.direction()[1];
 	direction[1] = -sin_theta * r.direction()[0] + cos_theta * r.direction()[1];
-	ray rotated_r(origin, direction);
+	return ray(origin, direction);
+}
+
+bool rotate_z::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	ray rotated_r = rotate_ray(r);
 	if (ptr->hit(rotated_r, t_min, t_max, rec))
 	{
 		vec3 p = rec.p;
@@ -159,12 +184,19 @@ class rotate_x : public hitable
 public:
 	rotate_x(hitable *p, float angle);
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return ptr->occluded(rotate_ray(r), t_min, t_max);
+	}
 	virtual bool bounding_box(aabb& box) const
 	{
 		box = bbox;
 		return hasbox;
 	}
 
+	//The ray in the object's unrotated frame
+	ray rotate_ray(const ray& r) const;
+
 	hitable *ptr;
 	float sin_theta;
 	float cos_theta;
@@ -205,7 +237,7 @@ rotate_x::rotate_x(hitable *p, float angle) : ptr(p)
 	bbox = aabb(min, max);
 }
 
-bool rotate_x::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+ray rotate_x::rotate_ray(const ray& r) const
 {
 	vec3 origin = r.origin();
 	vec3 direction = r.direction();
@@ -213,7 +245,12 @@ bool rotate_x::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	origin[2] = -sin_theta * r.origin()[1] + cos_theta * r.origin()[2];
 	direction[1] = cos_theta * r.direction()[1] + sin_theta * r.direction()[2];
 	direction[2] = -sin_theta * r.direction()[1] + cos_theta * r.direction()[2];
-	ray rotated_r(origin, direction);
+	return ray(origin, direction);
+}
+
+bool rotate_x::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	ray rotated_r = rotate_ray(r);
 	if (ptr->hit(rotated_r, t_min, t_max, rec))
 	{
 		vec3 p = rec.p;
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+//PCG32 (O'Neill, pcg-random.org): 64-bit LCG state, 32-bit output through a
+//	xorshift and random rotation. Each generator gets its own stream so
+//	threads never share or lock state, unlike rand().
+class pcg32
+{
+public:
+	pcg32(uint64_t seed = 0x853c49e6748fea9bULL, uint64_t stream = 0xda3e39cb94b95bdbULL)
+	{
+		seed_stream(seed, stream);
+	}
+
+	void seed_stream(uint64_t seed, uint64_t stream)
+	{
+		state = 0;
+		inc = (stream << 1) | 1;
+		next_uint();
+		state += seed;
+		next_uint();
+	}
+
+	uint32_t next_uint()
+	{
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+		uint32_t rot = uint32_t(old >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31));
+	}
+
+	//Uniform in [0, 1): the top 24 bits fill the float mantissa exactly
+	float next_float()
+	{
+		return float(next_uint() >> 8) * (1.0f / 16777216.0f);
+	}
+
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+//Source of the random numbers used by the camera and the materials.
+//	One lives in every thread (see thread_sampler()).
+class sampler
+{
+public:
+	sampler(uint64_t stream) : rng(0x853c49e6748fea9bULL, stream) {}
+
+	float next_1d() { return rng.next_float(); }
+
+	void next_2d(float& u, float& v)
+	{
+		u = rng.next_float();
+		v = rng.next_float();
+	}
+
+private:
+	pcg32 rng;
+};
+
+//Sampler of the calling thread, created on first use with the next free stream
+inline sampler& thread_sampler()
+{
+	static std::atomic<uint64_t> next_stream(0);
+	thread_local sampler s(next_stream++);
+	return s;
+}
+
+inline float random_float()
+{
+	return thread_sampler().next_1d();
+}
@@ -0,0 +1,612 @@
+#pragma once
+
+#include "hitable.h"
+#include "material.h"
+#include "sphere.h"
+#include "rect.h"
+#include "box.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+#include "mesh_cache.h"
+#include "rotate.h"
+#include "instance.h"
+#include "wide_bvh.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Text scene format, one statement per line, '#' starts a comment:
+//
+//	camera lookfrom 278 278 -800 lookat 278 278 0 [vup 0 1 0] [vfov 40] [aperture 0] [focus 10]
+//	material <name> lambertian <r> <g> <b>
+//	material <name> metal <r> <g> <b> <fuzz>
+//	material <name> dielectric <refractive index>
+//	material <name> diffuse_light <r> <g> <b>
+//	sphere <material> <cx> <cy> <cz> <radius>
+//	xy_rect <material> <x0> <x1> <y0> <y1> <z>       (xz_rect: x z y, yz_rect: y z x)
+//	box <material> <x0> <y0> <z0> <x1> <y1> <z1>
+//	triangle <material> <x y z> <x y z> <x y z>
+//	mesh <material> <file.obj>                         (path relative to the scene file)
+//
+//	Every primitive can be followed by modifiers, applied left to right:
+//	flip, rotate_x|rotate_y|rotate_z <degrees>, translate <x> <y> <z>, and
+//	for meshes scale <s>, which scales the vertices around the origin.
+//	Primitives with a diffuse_light material are also sampled as lights.
+//
+//	Geometry used many times is defined once as an object and placed with
+//	instance statements, which take flip, rotate_* and translate:
+//
+//	object <name>
+//	<primitives and instances of earlier objects, no lights>
+//	end
+//	instance <name> [modifiers]
+//
+//	An object is built once, into its own BVH if it has several parts, and
+//	each instance only adds a transform to the scene (instance.h), so memory
+//	follows the unique geometry rather than the number of copies.
+//
+//	The meshes, with their BVHs, are cached next to the scene in
+//	<scene>.cache (mesh_cache.h). Later loads map the cache and use the
+//	meshes in it directly instead of reading and building them again.
+
+//Where the camera sits, the image aspect comes from the render options
+struct scene_camera
+{
+	scene_camera() : lookfrom(278, 278, -800), lookat(278, 278, 0), vup(0, 1, 0), vfov(40.0f), aperture(0.0f), focus_dist(10.0f) {}
+
+	vec3 lookfrom, lookat, vup;
+	float vfov, aperture, focus_dist;
+};
+
+//What load_scene() builds: the top level primitives, still without an
+//	acceleration structure over them, and the emitters among them. Every
+//	object of the scene, materials included, lives in memory and is freed
+//	with it, by clear() or when the description goes away.
+struct scene_description
+{
+	scene_description() : n_triangles(0), n_instances(0), mesh_build_ms(0.0), cache(NULL), cached_meshes(0) {}
+
+	void clear()
+	{
+		camera = scene_camera();
+		objects.clear();
+		lights.clear();
+		n_triangles = 0;
+		definitions.clear();
+		n_instances = 0;
+		mesh_build_ms = 0.0;
+		meshes.clear();
+		mesh_sources.clear();
+		cache = NULL;
+		cached_meshes = 0;
+		memory.clear();
+	}
+
+	scene_camera camera;
+	std::vector<hitable*> objects;
+	std::vector<hitable*> lights;
+	size_t n_triangles; //in meshes, counted once however often they are instanced
+	std::vector<hitable*> definitions; //what the object blocks built, in file order
+	size_t n_instances;
+	double mesh_build_ms; //of load time, spent building the mesh and object BVHs
+
+	//Meshes in file order and where they came from, to write the cache
+	std::vector<const triangle_mesh*> meshes;
+	std::vector<mesh_cache_source> mesh_sources;
+	const mesh_cache *cache; //meshes are taken from, NULL without one
+	size_t cached_meshes; //of meshes, the ones mapped from the cache
+	arena memory;
+};
+
+//Splits one line into whitespace separated tokens in place and reads them
+//	with strtof, no stream per token
+class scene_tokens
+{
+public:
+	scene_tokens(char *line) : pos(0)
+	{
+		char *p = line + strspn(line, " \t\r");
+		while (*p)
+		{
+			tokens.push_back(p);
+			p += strcspn(p, " \t\r");
+			if (*p)
+				*p++ = '\0';
+			p += strspn(p, " \t\r");
+		}
+	}
+
+	bool done() const { return pos >= tokens.size(); }
+	bool empty() const { return tokens.empty(); }
+
+	bool word(std::string& out)
+	{
+		if (done())
+			return false;
+		out = tokens[pos++];
+		return true;
+	}
+
+	bool number(float& out)
+	{
+		if (done())
+			return false;
+		char *end;
+		out = strtof(tokens[pos], &end);
+		if (end == tokens[pos] || *end)
+			return false;
+		pos++;
+		return true;
+	}
+
+	bool point(vec3& out)
+	{
+		return number(out[0]) && number(out[1]) && number(out[2]);
+	}
+
+private:
+	std::vector<char*> tokens;
+	size_t pos;
+};
+
+bool read_file(const std::string& path, std::string& out)
+{
+	std::ifstream fin(path.c_str(), std::ios::binary);
+	if (!fin)
+		return false;
+	std::ostringstream contents;
+	contents << fin.rdbuf();
+	out = contents.str();
+	return true;
+}
+
+//Vertices and faces of a Wavefront OBJ file. Polygons are split into fans,
+//	normals, texture coordinates and everything else are ignored.
+bool load_obj(const std::string& path, std::vector<vec3>& vertices, std::vector<uint32_t>& indices)
+{
+	std::string text;
+	if (!read_file(path, text))
+	{
+		std::cerr << path << ": can't open" << std::endl;
+		return false;
+	}
+
+	const char *p = text.c_str();
+	int line = 1;
+	std::vector<uint32_t> face;
+	while (*p)
+	{
+		const char *end = p + strcspn(p, "\n");
+		if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			char *q = (char*)p + 1;
+			vec3 v;
+			for (int i = 0; i < 3; i++)
+				v[i] = strtof(q, &q);
+			vertices.push_back(v);
+		}
+		else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			//v, v/vt, v//vn or v/vt/vn, 1-based or negative from the end
+			face.clear();
+			char *q = (char*)p + 1;
+			while (q < end)
+			{
+				char *next;
+				long index = strtol(q, &next, 10);
+				if (next == q)
+					break;
+				if (index < 0)
+					index += long(vertices.size()) + 1;
+				if (index < 1 || index > long(vertices.size()))
+				{
+					std::cerr << path << ":" << line << ": vertex index out of range" << std::endl;
+					return false;
+				}
+				face.push_back(uint32_t(index - 1));
+				q = next + strcspn(next, " \t\r\n");
+			}
+			for (size_t i = 2; i < face.size(); i++)
+			{
+				indices.push_back(face[0]);
+				indices.push_back(face[i - 1]);
+				indices.push_back(face[i]);
+			}
+		}
+		p = *end ? end + 1 : end;
+		line++;
+	}
+	if (indices.empty())
+	{
+		std::cerr << path << ": no faces" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//Modifier following a primitive, see the format above
+struct scene_modifier
+{
+	std::string type;
+	vec3 value; //angle or scale in value[0]
+};
+
+bool parse_modifiers(scene_tokens& in, std::vector<scene_modifier>& modifiers, std::string& error)
+{
+	scene_modifier m;
+	while (in.word(m.type))
+	{
+		bool ok;
+		if (m.type == "flip")
+			ok = true;
+		else if (m.type == "rotate_x" || m.type == "rotate_y" || m.type == "rotate_z" || m.type == "scale")
+			ok = in.number(m.value[0]);
+		else if (m.type == "translate")
+			ok = in.point(m.value);
+		else
+			ok = false;
+		if (!ok)
+		{
+			error = "bad modifier " + m.type;
+			return false;
+		}
+		modifiers.push_back(m);
+	}
+	return true;
+}
+
+hitable *apply_modifiers(hitable *object, const std::vector<scene_modifier>& modifiers, arena& memory)
+{
+	for (const scene_modifier& m : modifiers)
+	{
+		if (m.type == "flip")
+			object = memory.create<flip_normals>(object);
+		else if (m.type == "rotate_x")
+			object = memory.create<rotate_x>(object, m.value[0]);
+		else if (m.type == "rotate_y")
+			object = memory.create<rotate_y>(object, m.value[0]);
+		else if (m.type == "rotate_z")
+			object = memory.create<rotate_z>(object, m.value[0]);
+		else if (m.type == "translate")
+			object = memory.create<translate>(object, m.value);
+	}
+	return object;
+}
+
+//Mesh statement: the OBJ file, scaled by the leading scale modifiers, which
+//	are removed from modifiers. Mapped from scene.cache instead if it holds
+//	the mesh built from the same file and scale.
+hitable *load_mesh(const std::string& file, material *mat, std::vector<scene_modifier>& modifiers, scene_description& scene, std::string& error)
+{
+	float scale = 1.0f;
+	size_t n_scales = 0;
+	while (n_scales < modifiers.size() && modifiers[n_scales].type == "scale")
+		scale *= modifiers[n_scales++].value[0];
+	modifiers.erase(modifiers.begin(), modifiers.begin() + n_scales);
+	for (const scene_modifier& m : modifiers)
+	{
+		if (m.type == "scale")
+		{
+			error = "scale has to come before the other modifiers";
+			return NULL;
+		}
+	}
+
+	mesh_cache_source source = mesh_source(file, scale);
+	triangle_mesh *mesh = scene.cache ? scene.cache->mesh(source, mat, scene.memory) : NULL;
+	if (mesh)
+		scene.cached_meshes++;
+	else
+	{
+		std::vector<vec3> vertices;
+		std::vector<uint32_t> indices;
+		if (!load_obj(file, vertices, indices))
+		{
+			error = "can't load mesh " + file;
+			return NULL;
+		}
+		if (scale != 1.0f)
+		{
+			for (vec3& v : vertices)
+				v *= scale;
+		}
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		mesh = scene.memory.create<triangle_mesh>(vertices, indices, mat);
+		std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+		scene.mesh_build_ms += std::chrono::duration<double, std::milli>(end - start).count();
+	}
+	scene.n_triangles += mesh->n_triangles();
+	scene.meshes.push_back(mesh);
+	scene.mesh_sources.push_back(source);
+	return mesh;
+}
+
+//Bottom level of an object block, built once however often it is
+//	instanced: the part itself if there is just one, else a wide_bvh over
+//	the parts
+hitable *define_object(std::vector<hitable*>& parts, scene_description& scene)
+{
+	hitable *object = parts[0];
+	if (parts.size() > 1)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		object = scene.memory.create<wide_bvh>(parts.data(), int(parts.size()));
+		std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+		scene.mesh_build_ms += std::chrono::duration<double, std::milli>(end - start).count();
+	}
+	scene.definitions.push_back(object);
+	return object;
+}
+
+//Instance statement: object placed by the modifiers, composed into a
+//	single transform rather than a chain of wrappers, together with the
+//	wrappers of a single part object. The instance is kept as it is by the
+//	BVHs, so it can be moved with instance::place().
+hitable *place_instance(hitable *object, const std::vector<scene_modifier>& modifiers, scene_description& scene, std::string& error)
+{
+	affine_transform to_world;
+	bool flip = false;
+	object = peel_transforms(object, to_world, flip);
+	for (const scene_modifier& m : modifiers)
+	{
+		float radians = (M_PI / 180) * m.value[0];
+		if (m.type == "flip")
+			flip = !flip;
+		else if (m.type == "rotate_x")
+			to_world = affine_transform::rotation(0, sin(radians), cos(radians)) * to_world;
+		else if (m.type == "rotate_y")
+			to_world = affine_transform::rotation(1, sin(radians), cos(radians)) * to_world;
+		else if (m.type == "rotate_z")
+			to_world = affine_transform::rotation(2, sin(radians), cos(radians)) * to_world;
+		else if (m.type == "translate")
+			to_world = affine_transform::translation(m.value) * to_world;
+		else
+		{
+			error = "instances can't be scaled";
+			return NULL;
+		}
+	}
+	scene.n_instances++;
+	return scene.memory.create<instance>(object, to_world, flip);
+}
+
+//Primitive of one line with its modifiers applied, NULL with error set if
+//	the line doesn't parse
+hitable *parse_primitive(const std::string& keyword, scene_tokens& in, material *mat, const std::string& dir, scene_description& scene, std::string& error)
+{
+	vec3 a, b, c;
+	float k = 0.0f;
+	std::string file;
+	bool ok;
+	//Rectangles: the two ranges, then the constant coordinate
+	if (keyword == "sphere")
+		ok = in.point(a) && in.number(k);
+	else if (keyword == "xy_rect" || keyword == "xz_rect" || keyword == "yz_rect")
+		ok = in.number(a[0]) && in.number(a[1]) && in.number(b[0]) && in.number(b[1]) && in.number(k);
+	else if (keyword == "box")
+		ok = in.point(a) && in.point(b);
+	else if (keyword == "triangle")
+		ok = in.point(a) && in.point(b) && in.point(c);
+	else if (keyword == "mesh")
+		ok = in.word(file);
+	else
+	{
+		error = "unknown statement " + keyword;
+		return NULL;
+	}
+
+	std::vector<scene_modifier> modifiers;
+	if (!ok)
+	{
+		error = "bad " + keyword;
+		return NULL;
+	}
+	if (!parse_modifiers(in, modifiers, error))
+		return NULL;
+
+	hitable *object;
+	if (keyword == "sphere")
+		object = scene.memory.create<sphere>(a, k, mat);
+	else if (keyword == "xy_rect")
+		object = scene.memory.create<xy_rect>(a[0], a[1], b[0], b[1], k, mat);
+	else if (keyword == "xz_rect")
+		object = scene.memory.create<xz_rect>(a[0], a[1], b[0], b[1], k, mat);
+	else if (keyword == "yz_rect")
+		object = scene.memory.create<yz_rect>(a[0], a[1], b[0], b[1], k, mat);
+	else if (keyword == "box")
+		object = scene.memory.create<box>(a, b, mat);
+	else if (keyword == "triangle")
+		object = scene.memory.create<triangle>(a, b, c, mat);
+	else
+	{
+		object = load_mesh(file[0] == '/' ? file : dir + file, mat, modifiers, scene, error);
+		if (!object)
+			return NULL;
+	}
+	for (const scene_modifier& m : modifiers)
+	{
+		if (m.type == "scale")
+		{
+			error = "only meshes can be scaled";
+			return NULL;
+		}
+	}
+	return apply_modifiers(object, modifiers, scene.memory);
+}
+
+//Parses the scene file at path into scene, replacing what it held. On an
+//	error prints file:line and the problem and returns false. With use_cache
+//	meshes come from the scene's mesh cache where it is up to date, and the
+//	cache is rewritten if any had to be built.
+bool load_scene(const std::string& path, scene_description& scene, bool use_cache = true)
+{
+	scene.clear();
+	std::string text;
+	if (!read_file(path, text))
+	{
+		std::cerr << path << ": can't open" << std::endl;
+		return false;
+	}
+	std::string dir = path.substr(0, path.find_last_of("/\\") + 1);
+
+	//Cached meshes point into the mapping, so it belongs to the scene too
+	std::string cache_path = path + ".cache";
+	if (use_cache)
+	{
+		mesh_cache *cache = scene.memory.create<mesh_cache>();
+		if (cache->open(cache_path))
+			scene.cache = cache;
+	}
+
+	std::map<std::string, material*> materials;
+	std::map<std::string, hitable*> definitions;
+	std::string defining; //name of the open object block, if any
+	std::vector<hitable*> parts; //of that block
+	char *p = &text[0];
+	for (int line_no = 1; *p; line_no++)
+	{
+		char *end = p + strcspn(p, "\n");
+		char *next = *end ? end + 1 : end;
+		*end = '\0';
+		if (char *comment = strchr(p, '#'))
+			*comment = '\0';
+		scene_tokens in(p);
+		p = next;
+		if (in.empty())
+			continue;
+
+		std::string error;
+		std::string keyword, name;
+		in.word(keyword);
+		if (keyword == "camera")
+		{
+			std::string key;
+			scene_camera& c = scene.camera;
+			while (error.empty() && in.word(key))
+			{
+				bool ok;
+				if (key == "lookfrom")
+					ok = in.point(c.lookfrom);
+				else if (key == "lookat")
+					ok = in.point(c.lookat);
+				else if (key == "vup")
+					ok = in.point(c.vup);
+				else if (key == "vfov")
+					ok = in.number(c.vfov);
+				else if (key == "aperture")
+					ok = in.number(c.aperture);
+				else if (key == "focus")
+					ok = in.number(c.focus_dist);
+				else
+					ok = false;
+				if (!ok)
+					error = "bad camera setting " + key;
+			}
+		}
+		else if (keyword == "material")
+		{
+			std::string type;
+			vec3 color;
+			float value;
+			material *mat = NULL;
+			if (!in.word(name) || !in.word(type))
+				error = "material needs a name and a type";
+			else if (type == "lambertian" && in.point(color))
+				mat = scene.memory.create<lambertian>(color);
+			else if (type == "metal" && in.point(color) && in.number(value))
+				mat = scene.memory.create<metal>(color, value);
+			else if (type == "dielectric" && in.number(value))
+				mat = scene.memory.create<dielectric>(value);
+			else if (type == "diffuse_light" && in.point(color))
+				mat = scene.memory.create<diffuse_light>(color);
+			else
+				error = "bad " + type + " material";
+			if (mat && !in.done())
+				error = "too many values for " + type;
+			if (error.empty())
+				materials[name] = mat;
+		}
+		else if (keyword == "object")
+		{
+			if (!defining.empty())
+				error = "object inside object " + defining;
+			else if (!in.word(name) || !in.done())
+				error = "object needs a name";
+			else if (definitions.count(name))
+				error = "object " + name + " is already defined";
+			else
+				defining = name;
+		}
+		else if (keyword == "end")
+		{
+			if (defining.empty())
+				error = "end without object";
+			else if (parts.empty())
+				error = "object " + defining + " is empty";
+			else
+			{
+				definitions[defining] = define_object(parts, scene);
+				defining.clear();
+				parts.clear();
+			}
+		}
+		else if (keyword == "instance")
+		{
+			std::vector<scene_modifier> modifiers;
+			if (!in.word(name) || !definitions.count(name))
+				error = "unknown object " + name;
+			else if (parse_modifiers(in, modifiers, error))
+			{
+				if (hitable *object = place_instance(definitions[name], modifiers, scene, error))
+					(defining.empty() ? scene.objects : parts).push_back(object);
+			}
+		}
+		else if (!in.word(name) || !materials.count(name))
+			error = "unknown material " + name;
+		else if (hitable *object = parse_primitive(keyword, in, materials[name], dir, scene, error))
+		{
+			bool light = materials[name]->kind() == MATERIAL_DIFFUSE_LIGHT;
+			if (!defining.empty() && light)
+				error = "lights can't be part of an object";
+			else if (!defining.empty())
+				parts.push_back(object);
+			else
+			{
+				scene.objects.push_back(object);
+				if (light)
+					scene.lights.push_back(object);
+			}
+		}
+
+		if (!error.empty())
+		{
+			std::cerr << path << ":" << line_no << ": " << error << std::endl;
+			return false;
+		}
+	}
+	if (!defining.empty())
+	{
+		std::cerr << path << ": object " << defining << " has no end" << std::endl;
+		return false;
+	}
+	if (scene.objects.empty())
+	{
+		std::cerr << path << ": no primitives" << std::endl;
+		return false;
+	}
+	if (use_cache && scene.cached_meshes < scene.meshes.size())
+	{
+		if (!write_mesh_cache(cache_path, scene.mesh_sources, scene.meshes))
+			std::cerr << cache_path << ": can't write mesh cache" << std::endl;
+	}
+	return true;
+}
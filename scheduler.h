@@ -0,0 +1,230 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+//Rectangle of pixels handed to a worker
+struct tile
+{
+	tile() {}
+	tile(int x_, int y_, int w_, int h_) : x(x_), y(y_), w(w_), h(h_) {}
+
+	int x, y, w, h;
+};
+
+//Chase-Lev work stealing deque (Le, Pop, Cohen, Zappa Nardelli, "Correct and
+//	Efficient Work-Stealing for Weak Memory Models", 2013) without resizing:
+//	the owner pushes and pops at the bottom, other threads steal from the top.
+//	Tiles are packed into 64 bits so every slot is a single atomic word.
+class tile_deque
+{
+public:
+	tile_deque() : top(0), bottom(0) {}
+
+	//capacity must be at least the number of tiles the deque can hold at once
+	void reset(int capacity)
+	{
+		int size = 1;
+		while (size < capacity)
+			size <<= 1;
+		if (int(buffer.size()) != size)
+			buffer = std::vector<std::atomic<uint64_t>>(size);
+		mask = size - 1;
+		top.store(0);
+		bottom.store(0);
+	}
+
+	//Owner only
+	void push(const tile& t)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		buffer[b & mask].store(pack(t), std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	//Owner only
+	bool pop(tile& out)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+		out = unpack(buffer[b & mask].load(std::memory_order_relaxed));
+		if (t == b)
+		{
+			//Last tile: race the thieves for it
+			bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	//Any thread
+	bool steal(tile& out)
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return false;
+		uint64_t packed = buffer[t & mask].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return false;
+		out = unpack(packed);
+		return true;
+	}
+
+private:
+	static uint64_t pack(const tile& t)
+	{
+		return uint64_t(uint16_t(t.x)) | uint64_t(uint16_t(t.y)) << 16 | uint64_t(uint16_t(t.w)) << 32 | uint64_t(uint16_t(t.h)) << 48;
+	}
+
+	static tile unpack(uint64_t p)
+	{
+		return tile(int(p & 0xffff), int((p >> 16) & 0xffff), int((p >> 32) & 0xffff), int(p >> 48));
+	}
+
+	//Separate cache lines, thieves hammer top while the owner works on bottom
+	alignas(64) std::atomic<int64_t> top;
+	alignas(64) std::atomic<int64_t> bottom;
+	std::vector<std::atomic<uint64_t>> buffer;
+	int64_t mask;
+};
+
+//Hands out the tiles of a frame to n_workers threads without a lock.
+//	Every worker starts with a contiguous run of tiles in its own deque and
+//	steals from the others once that runs dry. Near the end of the frame,
+//	when fewer tiles are left than there are workers to keep busy, a tile
+//	is split into four sub-tiles (down to min_tile_size) and the quarters
+//	are pushed back so idle workers can steal them.
+//	Edge tiles are clipped to the image, so tile_size need not divide it.
+//	A frame can be rendered in several passes over the image. Every pass
+//	covers each pixel exactly once and starts only after the last tile of
+//	the one before has finished, so the image is whole at every boundary.
+//	The worker that finishes that last tile queues the next pass in its own
+//	deque and the others steal from it; nobody blocks at the boundary.
+class tile_scheduler
+{
+public:
+	tile_scheduler() : n_workers(0) {}
+
+	tile_scheduler(int width, int height, int tile_size, int min_tile_size, int workers, int passes = 1)
+	{
+		reset(width, height, tile_size, min_tile_size, workers, passes);
+	}
+
+	void reset(int width, int height, int tile_size, int min_tile_size, int workers, int passes = 1)
+	{
+		n_workers = workers;
+		min_size = std::min(min_tile_size, tile_size);
+
+		tiles.clear();
+		for (int y = 0; y < height; y += tile_size)
+			for (int x = 0; x < width; x += tile_size)
+				tiles.push_back(tile(x, y, std::min(tile_size, width - x), std::min(tile_size, height - y)));
+		int n = int(tiles.size());
+
+		//Worst case every tile of the frame ends up split to the minimum size
+		//	and queued in the same deque
+		int min_tiles = ((width + min_size - 1) / min_size) * ((height + min_size - 1) / min_size);
+		if (int(deques.size()) != n_workers)
+			deques = std::vector<tile_deque>(n_workers);
+		for (int w = 0; w < n_workers; w++)
+		{
+			deques[w].reset(min_tiles + n);
+			//Pushed back to front so the owner pops its run in order and
+			//	thieves take from the far end
+			int first = int(int64_t(n) * w / n_workers);
+			int last = int(int64_t(n) * (w + 1) / n_workers);
+			for (int i = last - 1; i >= first; i--)
+				deques[w].push(tiles[i]);
+		}
+		current_pass.store(0);
+		passes_left.store(passes - 1);
+		pending.store(n);
+	}
+
+	//Next tile for worker, false once every pass of the frame is done
+	bool next(int worker, tile& out)
+	{
+		while (pending.load(std::memory_order_acquire) > 0 || passes_left.load(std::memory_order_acquire) > 0)
+		{
+			if (deques[worker].pop(out) || steal(worker, out))
+			{
+				split(worker, out);
+				return true;
+			}
+			std::this_thread::yield();
+		}
+		return false;
+	}
+
+	//Call after rendering a tile returned by next(). The last tile of a pass
+	//	starts the next one.
+	void finish(int worker)
+	{
+		if (pending.fetch_sub(1, std::memory_order_acq_rel) != 1 || passes_left.load(std::memory_order_acquire) == 0)
+			return;
+		//pending first so workers looking for tiles keep waiting, then
+		//	passes_left before any tile can finish
+		current_pass.fetch_add(1, std::memory_order_acq_rel);
+		pending.store(int(tiles.size()), std::memory_order_release);
+		passes_left.fetch_sub(1, std::memory_order_acq_rel);
+		for (int i = int(tiles.size()) - 1; i >= 0; i--)
+			deques[worker].push(tiles[i]);
+	}
+
+	int workers() const { return n_workers; }
+
+	//Pass the tiles handed out belong to; stays put while one is in flight
+	int pass() const { return current_pass.load(std::memory_order_acquire); }
+
+private:
+	bool steal(int worker, tile& out)
+	{
+		for (int i = 1; i < n_workers; i++)
+		{
+			if (deques[(worker + i) % n_workers].steal(out))
+				return true;
+		}
+		return false;
+	}
+
+	//Keeps the top left quarter in t and queues the other three
+	void split(int worker, tile& t)
+	{
+		if (n_workers < 2 || pending.load(std::memory_order_relaxed) >= 2 * n_workers)
+			return;
+		if (t.w < 2 * min_size || t.h < 2 * min_size)
+			return;
+
+		//Split on multiples of min_size so sub-tiles stay aligned to it
+		int w0 = (t.w / 2 + min_size - 1) / min_size * min_size;
+		int h0 = (t.h / 2 + min_size - 1) / min_size * min_size;
+		pending.fetch_add(3, std::memory_order_acq_rel);
+		deques[worker].push(tile(t.x + w0, t.y + h0, t.w - w0, t.h - h0));
+		deques[worker].push(tile(t.x, t.y + h0, w0, t.h - h0));
+		deques[worker].push(tile(t.x + w0, t.y, t.w - w0, h0));
+		t.w = w0;
+		t.h = h0;
+	}
+
+	int n_workers;
+	int min_size;
+	std::vector<tile_deque> deques;
+	std::vector<tile> tiles; //of one pass
+	std::atomic<int> pending; //tiles of the current pass queued or being rendered
+	std::atomic<int> passes_left; //passes still to start after the current one
+	std::atomic<int> current_pass;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+
+//Thin wrappers over the vector instruction set the build targets, so the
+//	wide kernels are written once. SIMD_WIDTH lanes: 8 with AVX2, 4 with SSE
+//	and 4 emulated lanes for the scalar fallback.
+#if defined(__AVX2__)
+#define SIMD_AVX2
+#include <immintrin.h>
+const int SIMD_WIDTH = 8;
+typedef __m256 vfloat;
+typedef __m256 vmask;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE
+#include <emmintrin.h>
+const int SIMD_WIDTH = 4;
+typedef __m128 vfloat;
+typedef __m128 vmask;
+#else
+#include <math.h>
+const int SIMD_WIDTH = 4;
+struct vfloat { float v[4]; };
+struct vmask { bool m[4]; };
+#endif
+
+#if defined(SIMD_AVX2)
+
+inline vfloat vset1(float a) { return _mm256_set1_ps(a); }
+inline vfloat vload(const float *p) { return _mm256_load_ps(p); }
+inline vfloat vloadu(const float *p) { return _mm256_loadu_ps(p); }
+inline void vstore(float *p, vfloat a) { _mm256_store_ps(p, a); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+inline vfloat vabs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+inline vmask vlt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline vmask vgt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline vmask vge(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline vmask vle(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline vmask vand(vmask a, vmask b) { return _mm256_and_ps(a, b); }
+inline int vmovemask(vmask a) { return _mm256_movemask_ps(a); }
+//Unaligned lanes of unsigned counts below 2^31 as floats
+inline vfloat vload_uint(const unsigned int *p) { return _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)p)); }
+//Packs lanes of r, g, b in [0, 255] into RGBA8 pixels, alpha 255, truncating
+inline void vstore_rgba8(uint8_t *p, vfloat r, vfloat g, vfloat b)
+{
+	__m256i rgba = _mm256_or_si256(_mm256_or_si256(_mm256_cvttps_epi32(r), _mm256_slli_epi32(_mm256_cvttps_epi32(g), 8)),
+		_mm256_or_si256(_mm256_slli_epi32(_mm256_cvttps_epi32(b), 16), _mm256_set1_epi32(int(0xff000000))));
+	_mm256_storeu_si256((__m256i*)p, rgba);
+}
+
+#elif defined(SIMD_SSE)
+
+inline vfloat vset1(float a) { return _mm_set1_ps(a); }
+inline vfloat vload(const float *p) { return _mm_load_ps(p); }
+inline vfloat vloadu(const float *p) { return _mm_loadu_ps(p); }
+inline void vstore(float *p, vfloat a) { _mm_store_ps(p, a); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+inline vfloat vabs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline vmask vlt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+inline vmask vgt(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+inline vmask vge(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+inline vmask vle(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+inline vmask vand(vmask a, vmask b) { return _mm_and_ps(a, b); }
+inline int vmovemask(vmask a) { return _mm_movemask_ps(a); }
+inline vfloat vload_uint(const unsigned int *p) { return _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)p)); }
+inline void vstore_rgba8(uint8_t *p, vfloat r, vfloat g, vfloat b)
+{
+	__m128i rgba = _mm_or_si128(_mm_or_si128(_mm_cvttps_epi32(r), _mm_slli_epi32(_mm_cvttps_epi32(g), 8)),
+		_mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(b), 16), _mm_set1_epi32(int(0xff000000))));
+	_mm_storeu_si128((__m128i*)p, rgba);
+}
+
+#else
+
+#define SIMD_LANEWISE(expr) vfloat r; for (int i = 0; i < 4; i++) r.v[i] = expr; return r
+#define SIMD_MASKWISE(expr) vmask r; for (int i = 0; i < 4; i++) r.m[i] = expr; return r
+
+inline vfloat vset1(float a) { SIMD_LANEWISE(a); }
+inline vfloat vload(const float *p) { SIMD_LANEWISE(p[i]); }
+inline vfloat vloadu(const float *p) { SIMD_LANEWISE(p[i]); }
+inline void vstore(float *p, vfloat a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+inline vfloat vadd(vfloat a, vfloat b) { SIMD_LANEWISE(a.v[i] + b.v[i]); }
+inline vfloat vsub(vfloat a, vfloat b) { SIMD_LANEWISE(a.v[i] - b.v[i]); }
+inline vfloat vmul(vfloat a, vfloat b) { SIMD_LANEWISE(a.v[i] * b.v[i]); }
+inline vfloat vdiv(vfloat a, vfloat b) { SIMD_LANEWISE(a.v[i] / b.v[i]); }
+inline vfloat vsqrt(vfloat a) { SIMD_LANEWISE(sqrtf(a.v[i])); }
+//Same operand order as minps/maxps: the second operand wins on NaN
+inline vfloat vmin(vfloat a, vfloat b) { SIMD_LANEWISE(a.v[i] < b.v[i] ? a.v[i] : b.v[i]); }
+inline vfloat vmax(vfloat a, vfloat b) { SIMD_LANEWISE(a.v[i] > b.v[i] ? a.v[i] : b.v[i]); }
+inline vfloat vabs(vfloat a) { SIMD_LANEWISE(a.v[i] < 0.0f ? -a.v[i] : a.v[i]); }
+inline vmask vlt(vfloat a, vfloat b) { SIMD_MASKWISE(a.v[i] < b.v[i]); }
+inline vmask vgt(vfloat a, vfloat b) { SIMD_MASKWISE(a.v[i] > b.v[i]); }
+inline vmask vge(vfloat a, vfloat b) { SIMD_MASKWISE(a.v[i] >= b.v[i]); }
+inline vmask vle(vfloat a, vfloat b) { SIMD_MASKWISE(a.v[i] <= b.v[i]); }
+inline vmask vand(vmask a, vmask b) { SIMD_MASKWISE(a.m[i] && b.m[i]); }
+inline int vmovemask(vmask a)
+{
+	int bits = 0;
+	for (int i = 0; i < 4; i++)
+		bits |= int(a.m[i]) << i;
+	return bits;
+}
+inline vfloat vload_uint(const unsigned int *p) { SIMD_LANEWISE(float(p[i])); }
+inline void vstore_rgba8(uint8_t *p, vfloat r, vfloat g, vfloat b)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		p[i * 4 + 0] = uint8_t(r.v[i]);
+		p[i * 4 + 1] = uint8_t(g.v[i]);
+		p[i * 4 + 2] = uint8_t(b.v[i]);
+		p[i * 4 + 3] = 255;
+	}
+}
+
+#undef SIMD_LANEWISE
+#undef SIMD_MASKWISE
+
+#endif
+
+//Index of the lowest set bit of a non-zero mask
+inline int first_set_lane(int mask)
+{
+	int i = 0;
+	while (!(mask & (1 << i)))
+		i++;
+	return i;
+}
+
+//Number of set bits of a mask
+inline int lane_count(int mask)
+{
+	int n = 0;
+	for (; mask; mask &= mask - 1)
+		n++;
+	return n;
+}
@@ -10,6 +10,9 @@ public:
 	sphere(vec3 cen, float r, material *m) : center(cen), radius(r), mat_ptr(m) {};
 	virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec) const;
 	virtual bool bounding_box(aabb& box) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual float pdf_value(const vec3& o, const vec3& v) const;
+	virtual vec3 random(const vec3& o) const;
 	vec3 center;
 	float radius;
 	material *mat_ptr;
@@ -47,8 +50,55 @@ bool sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
 	return false;
 }
 
+bool sphere::occluded(const ray& r, float t_min, float t_max) const
+{
+	vec3 oc = r.origin() - center;
+	float a = dot(r.direction(), r.direction());
+	float b = dot(oc, r.direction());
+	float c = dot(oc, oc) - radius * radius;
+	float discriminant = b * b - a * c;
+	if (discriminant <= 0)
+		return false;
+	float root = sqrt(discriminant);
+	float near_t = (-b - root) / a;
+	float far_t = (-b + root) / a;
+	return (near_t < t_max && near_t > t_min) || (far_t < t_max && far_t > t_min);
+}
+
 bool sphere::bounding_box(aabb& box) const
 {
 	box = aabb(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius));
 	return true;
+}
+
+//Samples the cone of directions from o that the sphere subtends, uniformly
+//	in solid angle, so the density is one over the cone's solid angle.
+float sphere::pdf_value(const vec3& o, const vec3& v) const
+{
+	hit_record rec;
+	if (!hit(ray(o, v), 0.001, FLT_MAX, rec))
+		return 0.0f;
+	float cos_theta_max = sqrt(std::max(0.0f, 1 - radius * radius / (center - o).squared_length()));
+	float solid_angle = 2 * M_PI * (1 - cos_theta_max);
+	return 1 / solid_angle;
+}
+
+vec3 sphere::random(const vec3& o) const
+{
+	vec3 direction = center - o;
+	float distance_squared = direction.squared_length();
+	float cos_theta_max = sqrt(std::max(0.0f, 1 - radius * radius / distance_squared));
+
+	//Orthonormal basis with w towards the center
+	vec3 w = unit_vector(direction);
+	vec3 a = fabs(w.x()) > 0.9f ? vec3(0, 1, 0) : vec3(1, 0, 0);
+	vec3 v = unit_vector(cross(w, a));
+	vec3 u = cross(w, v);
+
+	float r1 = random_float();
+	float r2 = random_float();
+	float z = 1 + r2 * (cos_theta_max - 1);
+	float phi = 2 * M_PI * r1;
+	float sin_theta = sqrt(std::max(0.0f, 1 - z * z));
+	return cos(phi) * sin_theta * u + sin(phi) * sin_theta * v + z * w;
 }
\ No newline at end of file
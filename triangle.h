@@ -16,8 +16,13 @@ public:
 		return true;
 	}
 
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual float pdf_value(const vec3& o, const vec3& v) const;
+	virtual vec3 random(const vec3& o) const;
+
 	bool geometricSolution(const ray& r, float t_min, float t_max, hit_record& rec) const;
 	bool MTAlgo(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	bool MTIntersect(const ray& r, float t_min, float t_max, float& t) const;
 
 	vec3 v0, v1, v2;
 	vec3 pmin, pmax;
@@ -51,6 +56,35 @@ bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	return MTAlgo(r, t_min, t_max, rec);
 }
 
+bool triangle::occluded(const ray& r, float t_min, float t_max) const
+{
+	float t;
+	return MTIntersect(r, t_min, t_max, t);
+}
+
+float triangle::pdf_value(const vec3& o, const vec3& v) const
+{
+	hit_record rec;
+	if (!hit(ray(o, v), 0.001, FLT_MAX, rec))
+		return 0.0f;
+	float area = 0.5f * cross(v1 - v0, v2 - v0).length();
+	return area_to_solid_angle_pdf(rec, v, area);
+}
+
+//Uniform point on the triangle: folding the unit square onto its lower
+//	half keeps the barycentric coordinates uniform
+vec3 triangle::random(const vec3& o) const
+{
+	float a = random_float();
+	float b = random_float();
+	if (a + b > 1)
+	{
+		a = 1 - a;
+		b = 1 - b;
+	}
+	return v0 + a * (v1 - v0) + b * (v2 - v0) - o;
+}
+
 
 /*
 First we will compute the triangle's normal, then test if the ray and the triangle are parallel. If they are, the intersection test fails. If they are not parallel, we compute t from which we can compute the intersection point P. If the inside-out test succeeds (we test if P is on the left side of each one of the triangle's edges) then the ray intersects the triangle and P is inside the triangle's boundaries
@@ -114,10 +148,24 @@ bool triangle::geometricSolution(const ray& r, float t_min, float t_max, hit_rec
 }
 
 bool triangle::MTAlgo(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	float t;
+	if (!MTIntersect(r, t_min, t_max, t))
+		return false;
+	rec.t = t;
+	rec.mat_ptr = mat_ptr;
+	rec.normal = N;
+	rec.p = r.point_at_parameter(t);
+	//std::cout << rec.p << std::endl;
+	return true;
+}
+
+//Moller-Trumbore, only computing t
+bool triangle::MTIntersect(const ray& r, float t_min, float t_max, float& t) const
 {
 	vec3 v0v1 = v1 - v0;
 	vec3 v0v2 = v2 - v0;
-	float t, u, v;
+	float u, v;
 
 	vec3 pvec = cross(r.direction(), v0v2);
 	float det = dot(v0v1, pvec);
@@ -149,12 +197,5 @@ bool triangle::MTAlgo(const ray& r, float t_min, float t_max, hit_record& rec) c
 
 	t = dot(v0v2, qvec) * invDet;
 
-	if (t < t_min || t > t_max)
-		return false;
-	rec.t = t;
-	rec.mat_ptr = mat_ptr;
-	rec.normal = N;
-	rec.p = r.point_at_parameter(t);
-	//std::cout << rec.p << std::endl;
-	return true;
+	return !(t < t_min || t > t_max);
 }
\ No newline at end of file
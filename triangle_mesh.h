@@ -0,0 +1,211 @@
+#pragma once
+
+#include "hitable.h"
+#include "linear_bvh.h"
+#include "triangle_packet.h"
+#include "array_view.h"
+#include <stdint.h>
+#include <vector>
+
+//Indexed triangle mesh. All triangles share one vertex array and one material
+//	and are referenced by three 32-bit indices each, so a triangle costs 12
+//	bytes of indices plus its share of vertices and BVH nodes instead of a
+//	separately allocated triangle object.
+//	The mesh carries its own BVH over triangle indices; the index buffer is
+//	reordered into leaf order so every leaf covers a contiguous run of it.
+//	Leaves hold up to TRIANGLE_PACKET_WIDTH triangles and point at SoA
+//	packets with precomputed edges instead of at the index buffer.
+//	Triangles are two-sided, the normal follows counter-clockwise winding.
+//	The arrays are views: into the mesh's own storage when it builds them,
+//	or into memory it doesn't own, such as a mapped mesh cache.
+class triangle_mesh : public hitable
+{
+public:
+	triangle_mesh() {}
+	triangle_mesh(const std::vector<vec3>& verts, const std::vector<uint32_t>& idx, material *mat, bvh_quality quality = BVH_MEDIUM);
+	//Mesh over arrays a triangle_mesh built before, which must outlive it
+	triangle_mesh(array_view<const vec3> verts, array_view<const uint32_t> idx, array_view<const linear_bvh_node> bvh, array_view<const triangle_packet> pkts, material *mat)
+		: vertices(verts), indices(idx), nodes(bvh), packets(pkts), mat_ptr(mat) {}
+	//The views may point into this mesh
+	triangle_mesh(const triangle_mesh&) = delete;
+	triangle_mesh& operator=(const triangle_mesh&) = delete;
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual bool bounding_box(aabb& box) const
+	{
+		box = nodes[0].bounds;
+		return true;
+	}
+
+	int n_triangles() const { return int(indices.size() / 3); }
+	aabb triangle_bounds(int tri) const;
+	bool intersect_triangle(int tri, const ray& r, float t_min, float t_max, float& t) const;
+	size_t memory_usage() const;
+
+	array_view<const vec3> vertices;
+	array_view<const uint32_t> indices; //3 per triangle, in leaf order
+	array_view<const linear_bvh_node> nodes;
+	array_view<const triangle_packet> packets;
+	material *mat_ptr;
+
+private:
+	//Arrays of a mesh built by the constructor
+	std::vector<vec3> vertex_storage;
+	std::vector<uint32_t> index_storage;
+	std::vector<linear_bvh_node> node_storage;
+	std::vector<triangle_packet> packet_storage;
+};
+
+triangle_mesh::triangle_mesh(const std::vector<vec3>& verts, const std::vector<uint32_t>& idx, material *mat, bvh_quality quality)
+	: mat_ptr(mat), vertex_storage(verts), index_storage(idx)
+{
+	vertices = vertex_storage;
+	indices = index_storage;
+	int n = n_triangles();
+	std::vector<bvh_primitive_info> info(n);
+	for (int i = 0; i < n; i++)
+		info[i] = bvh_primitive_info(i, triangle_bounds(i));
+
+	int total_nodes = 0;
+	std::vector<int> ordered;
+	bvh_build_node *root = bvh_build(info, TRIANGLE_PACKET_WIDTH, quality, total_nodes, ordered, TRIANGLE_PACKET_WIDTH);
+
+	for (int i = 0; i < n; i++)
+	{
+		index_storage[3 * i + 0] = idx[3 * ordered[i] + 0];
+		index_storage[3 * i + 1] = idx[3 * ordered[i] + 1];
+		index_storage[3 * i + 2] = idx[3 * ordered[i] + 2];
+	}
+
+	node_storage.reserve(total_nodes);
+	flatten_bvh_tree(root, node_storage);
+	bvh_free_build_tree(root);
+
+	//Repoint every leaf from its triangle range to the packets holding it
+	for (size_t i = 0; i < node_storage.size(); i++)
+	{
+		linear_bvh_node& node = node_storage[i];
+		if (node.n_primitives == 0)
+			continue;
+		int first = node.primitives_offset;
+		int count = node.n_primitives;
+		node.primitives_offset = int(packet_storage.size());
+		node.n_primitives = uint16_t((count + TRIANGLE_PACKET_WIDTH - 1) / TRIANGLE_PACKET_WIDTH);
+		for (int j = 0; j < count; j++)
+		{
+			if (j % TRIANGLE_PACKET_WIDTH == 0)
+			{
+				packet_storage.push_back(triangle_packet());
+				packet_storage.back().clear();
+			}
+			int tri = first + j;
+			packet_storage.back().set(j % TRIANGLE_PACKET_WIDTH, tri, vertices[indices[3 * tri + 0]], vertices[indices[3 * tri + 1]], vertices[indices[3 * tri + 2]]);
+		}
+	}
+	nodes = node_storage;
+	packets = packet_storage;
+}
+
+aabb triangle_mesh::triangle_bounds(int tri) const
+{
+	const vec3& v0 = vertices[indices[3 * tri + 0]];
+	const vec3& v1 = vertices[indices[3 * tri + 1]];
+	const vec3& v2 = vertices[indices[3 * tri + 2]];
+	vec3 pmin, pmax;
+	for (int i = 0; i < 3; i++)
+	{
+		//Pad like the rects do, so axis aligned triangles get a non-empty box
+		pmin[i] = std::min(std::min(v0[i], v1[i]), v2[i]) - 0.0001f;
+		pmax[i] = std::max(std::max(v0[i], v1[i]), v2[i]) + 0.0001f;
+	}
+	return aabb(pmin, pmax);
+}
+
+//Scalar Moller-Trumbore on one triangle, only computing t.
+//	Kept as the reference for the packet kernel.
+inline bool triangle_mesh::intersect_triangle(int tri, const ray& r, float t_min, float t_max, float& t) const
+{
+	const vec3& v0 = vertices[indices[3 * tri + 0]];
+	vec3 v0v1 = vertices[indices[3 * tri + 1]] - v0;
+	vec3 v0v2 = vertices[indices[3 * tri + 2]] - v0;
+
+	vec3 pvec = cross(r.direction(), v0v2);
+	float det = dot(v0v1, pvec);
+	if (fabs(det) < 1e-8f)
+		return false;
+	float invDet = 1.0f / det;
+
+	vec3 tvec = r.origin() - v0;
+	float u = dot(tvec, pvec) * invDet;
+	if (u < 0 || u > 1)
+		return false;
+
+	vec3 qvec = cross(tvec, v0v1);
+	float v = dot(r.direction(), qvec) * invDet;
+	if (v < 0 || u + v > 1)
+		return false;
+
+	t = dot(v0v2, qvec) * invDet;
+	return t > t_min && t < t_max;
+}
+
+bool triangle_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	int hit_tri = -1;
+	float hit_t = t_max;
+	packet_ray pr(r);
+	const triangle_packet *p = packets.data();
+	traverse_linear_bvh(nodes.data(), r, t_min, t_max,
+		[&](int first, int count, float t0, float& closest)
+	{
+		bool hit_anything = false;
+		for (int i = first; i < first + count; i++)
+		{
+			float t;
+			int lane = intersect_triangle_packet(p[i], pr, t0, closest, t);
+			if (lane >= 0)
+			{
+				hit_anything = true;
+				closest = t;
+				hit_tri = p[i].id[lane];
+				hit_t = t;
+			}
+		}
+		return hit_anything;
+	});
+
+	if (hit_tri < 0)
+		return false;
+
+	const vec3& v0 = vertices[indices[3 * hit_tri + 0]];
+	const vec3& v1 = vertices[indices[3 * hit_tri + 1]];
+	const vec3& v2 = vertices[indices[3 * hit_tri + 2]];
+	rec.t = hit_t;
+	rec.p = r.point_at_parameter(hit_t);
+	rec.normal = unit_vector(cross(v1 - v0, v2 - v0));
+	rec.mat_ptr = mat_ptr;
+	return true;
+}
+
+bool triangle_mesh::occluded(const ray& r, float t_min, float t_max) const
+{
+	packet_ray pr(r);
+	const triangle_packet *p = packets.data();
+	return occluded_linear_bvh(nodes.data(), r, t_min, t_max,
+		[&](int first, int count)
+	{
+		float t;
+		for (int i = first; i < first + count; i++)
+		{
+			if (intersect_triangle_packet(p[i], pr, t_min, t_max, t) >= 0)
+				return true;
+		}
+		return false;
+	});
+}
+
+size_t triangle_mesh::memory_usage() const
+{
+	//Arrays in a mapped cache count too, they are resident while in use
+	return sizeof(*this) + vertices.size() * sizeof(vec3) + indices.size() * sizeof(uint32_t) + nodes.size() * sizeof(linear_bvh_node) + packets.size() * sizeof(triangle_packet);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "ray.h"
+#include "simd.h"
+#include <cfloat>
+
+const int TRIANGLE_PACKET_WIDTH = SIMD_WIDTH;
+
+//SIMD_WIDTH triangles stored SoA with their edges precomputed, so one ray is
+//	tested against all of them by a single vectorised Moller-Trumbore pass.
+//	Unused lanes have zero edges; their determinant is 0 and they never hit.
+struct alignas(32) triangle_packet
+{
+	float v0[3][TRIANGLE_PACKET_WIDTH];
+	float e1[3][TRIANGLE_PACKET_WIDTH]; //v1 - v0
+	float e2[3][TRIANGLE_PACKET_WIDTH]; //v2 - v0
+	int id[TRIANGLE_PACKET_WIDTH]; //triangle index, -1 for unused lanes
+
+	void clear()
+	{
+		for (int i = 0; i < TRIANGLE_PACKET_WIDTH; i++)
+		{
+			for (int a = 0; a < 3; a++)
+				v0[a][i] = e1[a][i] = e2[a][i] = 0.0f;
+			id[i] = -1;
+		}
+	}
+
+	void set(int lane, int tri, const vec3& p0, const vec3& p1, const vec3& p2)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			v0[a][lane] = p0[a];
+			e1[a][lane] = p1[a] - p0[a];
+			e2[a][lane] = p2[a] - p0[a];
+		}
+		id[lane] = tri;
+	}
+};
+
+//Ray origin and direction broadcast into every lane once per ray
+struct packet_ray
+{
+	packet_ray(const ray& r)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			org[a] = vset1(r.origin()[a]);
+			dir[a] = vset1(r.direction()[a]);
+		}
+	}
+
+	vfloat org[3];
+	vfloat dir[3];
+};
+
+//Intersects the ray with every lane of the packet. Returns the lane of the
+//	closest hit in (t_min, t_max) and its t, or -1 when nothing is hit.
+inline int intersect_triangle_packet(const triangle_packet& p, const packet_ray& r, float t_min, float t_max, float& t_hit)
+{
+	vfloat e1x = vload(p.e1[0]), e1y = vload(p.e1[1]), e1z = vload(p.e1[2]);
+	vfloat e2x = vload(p.e2[0]), e2y = vload(p.e2[1]), e2z = vload(p.e2[2]);
+
+	//pvec = dir x e2
+	vfloat px = vsub(vmul(r.dir[1], e2z), vmul(r.dir[2], e2y));
+	vfloat py = vsub(vmul(r.dir[2], e2x), vmul(r.dir[0], e2z));
+	vfloat pz = vsub(vmul(r.dir[0], e2y), vmul(r.dir[1], e2x));
+	vfloat det = vadd(vadd(vmul(e1x, px), vmul(e1y, py)), vmul(e1z, pz));
+	vfloat inv_det = vdiv(vset1(1.0f), det);
+
+	vfloat tx = vsub(r.org[0], vload(p.v0[0]));
+	vfloat ty = vsub(r.org[1], vload(p.v0[1]));
+	vfloat tz = vsub(r.org[2], vload(p.v0[2]));
+	vfloat u = vmul(vadd(vadd(vmul(tx, px), vmul(ty, py)), vmul(tz, pz)), inv_det);
+
+	//qvec = tvec x e1
+	vfloat qx = vsub(vmul(ty, e1z), vmul(tz, e1y));
+	vfloat qy = vsub(vmul(tz, e1x), vmul(tx, e1z));
+	vfloat qz = vsub(vmul(tx, e1y), vmul(ty, e1x));
+	vfloat v = vmul(vadd(vadd(vmul(r.dir[0], qx), vmul(r.dir[1], qy)), vmul(r.dir[2], qz)), inv_det);
+	vfloat t = vmul(vadd(vadd(vmul(e2x, qx), vmul(e2y, qy)), vmul(e2z, qz)), inv_det);
+
+	vfloat zero = vset1(0.0f);
+	vmask hit = vgt(vabs(det), vset1(1e-8f));
+	hit = vand(hit, vge(u, zero));
+	hit = vand(hit, vge(v, zero));
+	hit = vand(hit, vle(vadd(u, v), vset1(1.0f)));
+	hit = vand(hit, vgt(t, vset1(t_min)));
+	hit = vand(hit, vlt(t, vset1(t_max)));
+	int mask = vmovemask(hit);
+	if (!mask)
+		return -1;
+
+	alignas(32) float ts[TRIANGLE_PACKET_WIDTH];
+	vstore(ts, t);
+	int best = -1;
+	t_hit = t_max;
+	while (mask)
+	{
+		int i = first_set_lane(mask);
+		mask &= mask - 1;
+		if (ts[i] < t_hit)
+		{
+			t_hit = ts[i];
+			best = i;
+		}
+	}
+	return best;
+}
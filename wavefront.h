@@ -0,0 +1,204 @@
+#pragma once
+
+#include "hitable.h"
+#include "material.h"
+#include "camera.h"
+#include <cfloat>
+#include <vector>
+
+//Wavefront (stream) path tracer. Instead of following one path at a time
+//	through the recursive color(), all paths of a tile live in SoA buffers
+//	and are advanced together, one stage at a time:
+//		generate - camera rays for every pixel sample of the tile
+//		extend   - closest hit for every live path
+//		shade    - emission and scattering, paths grouped by material kind
+//		compact  - move the paths that are still alive to the front
+//	Paths use the same depth limit, ray length and Russian roulette as
+//	shade() but no light sampling, so the result matches color() in
+//	expectation only. A tile's paths go through in batches of at most
+//	WAVEFRONT_BATCH, so the buffers stay the same size whatever the tile
+//	size and sample count.
+const int WAVEFRONT_BATCH = 65536;
+
+class wavefront_integrator
+{
+public:
+	wavefront_integrator(int max_depth = 50, int rr_min_depth = 3) : _max_depth(max_depth), _rr_min_depth(rr_min_depth) {}
+
+	//Renders the w x h pixels at (x0, y0) with spp samples each into out
+	//	(row major, w * h entries), summed over the samples.
+	void render_tile(hitable *world, camera& cam, int x0, int y0, int w, int h, int image_width, int image_height, int spp, vec3 *out);
+
+private:
+	void resize(int n);
+	void generate(camera& cam, int x0, int y0, int w, int image_width, int image_height, int spp, long long first, int n);
+	void extend(hitable *world);
+	void shade(vec3 *out);
+	void compact();
+
+	void set_ray(int i, const ray& r)
+	{
+		ox[i] = r.origin().x(); oy[i] = r.origin().y(); oz[i] = r.origin().z();
+		dx[i] = r.direction().x(); dy[i] = r.direction().y(); dz[i] = r.direction().z();
+	}
+
+	ray get_ray(int i) const
+	{
+		return ray(vec3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]));
+	}
+
+	int _max_depth;
+	int _rr_min_depth;
+	int n_paths;
+
+	//Path state, one entry per live path
+	std::vector<float> ox, oy, oz;
+	std::vector<float> dx, dy, dz;
+	std::vector<float> tr, tg, tb; //throughput
+	std::vector<int> pixel;
+	std::vector<int> depth;
+	std::vector<char> alive;
+
+	//Closest hit of the path's current ray
+	std::vector<hit_record> recs;
+	std::vector<char> has_hit;
+
+	//Path indices bucketed by material kind for the shade stage
+	std::vector<int> order;
+};
+
+void wavefront_integrator::render_tile(hitable *world, camera& cam, int x0, int y0, int w, int h, int image_width, int image_height, int spp, vec3 *out)
+{
+	for (int i = 0; i < w * h; i++)
+		out[i] = vec3(0.0f, 0.0f, 0.0f);
+
+	long long total = (long long)w * h * spp;
+	for (long long first = 0; first < total; first += WAVEFRONT_BATCH)
+	{
+		generate(cam, x0, y0, w, image_width, image_height, spp, first, int(std::min<long long>(total - first, WAVEFRONT_BATCH)));
+		while (n_paths > 0)
+		{
+			extend(world);
+			shade(out);
+			compact();
+		}
+	}
+}
+
+void wavefront_integrator::resize(int n)
+{
+	ox.resize(n); oy.resize(n); oz.resize(n);
+	dx.resize(n); dy.resize(n); dz.resize(n);
+	tr.resize(n); tg.resize(n); tb.resize(n);
+	pixel.resize(n);
+	depth.resize(n);
+	alive.resize(n);
+	recs.resize(n);
+	has_hit.resize(n);
+	order.resize(n);
+}
+
+//Camera rays for n of the tile's w * h * spp samples, starting at first,
+//	counted pixel by pixel in rows and sample by sample within a pixel
+void wavefront_integrator::generate(camera& cam, int x0, int y0, int w, int image_width, int image_height, int spp, long long first, int n)
+{
+	n_paths = n;
+	if (int(ox.size()) < n_paths)
+		resize(n_paths);
+
+	sampler& smp = thread_sampler();
+	for (int i = 0; i < n; i++)
+	{
+		int p = int((first + i) / spp);
+		int x = p % w, y = p / w;
+		float jx, jy;
+		smp.next_2d(jx, jy);
+		float u = float(x0 + x + jx) / float(image_width);
+		float v = float(y0 + y + jy) / float(image_height);
+		set_ray(i, cam.get_ray(u, v));
+		tr[i] = tg[i] = tb[i] = 1.0f;
+		pixel[i] = p;
+		depth[i] = 0;
+		alive[i] = 1;
+	}
+}
+
+void wavefront_integrator::extend(hitable *world)
+{
+	for (int i = 0; i < n_paths; i++)
+		has_hit[i] = world->hit(get_ray(i), 0.001f, RAY_T_MAX, recs[i]);
+}
+
+void wavefront_integrator::shade(vec3 *out)
+{
+	//Counting sort of the hits by material kind, misses end their path
+	int counts[MATERIAL_KIND_COUNT + 1] = {};
+	for (int i = 0; i < n_paths; i++)
+	{
+		if (has_hit[i])
+			counts[recs[i].mat_ptr->kind() + 1]++;
+		else
+			alive[i] = 0; //Background is black
+	}
+	for (int k = 1; k <= MATERIAL_KIND_COUNT; k++)
+		counts[k] += counts[k - 1];
+	int n_hits = counts[MATERIAL_KIND_COUNT];
+	for (int i = 0; i < n_paths; i++)
+	{
+		if (has_hit[i])
+			order[counts[recs[i].mat_ptr->kind()]++] = i;
+	}
+
+	for (int j = 0; j < n_hits; j++)
+	{
+		int i = order[j];
+		const hit_record& rec = recs[i];
+		vec3 throughput(tr[i], tg[i], tb[i]);
+		out[pixel[i]] += throughput * rec.mat_ptr->emitted();
+
+		ray scattered;
+		vec3 attenuation;
+		if (depth[i] < _max_depth && rec.mat_ptr->scatter(get_ray(i), rec, attenuation, scattered))
+		{
+			throughput *= attenuation;
+			if (depth[i] >= _rr_min_depth)
+			{
+				float q = std::min(std::max(throughput.r(), std::max(throughput.g(), throughput.b())), 0.95f);
+				if (random_float() >= q)
+				{
+					alive[i] = 0;
+					continue;
+				}
+				throughput /= q;
+			}
+			tr[i] = throughput.r(); tg[i] = throughput.g(); tb[i] = throughput.b();
+			set_ray(i, scattered);
+			depth[i]++;
+		}
+		else
+		{
+			alive[i] = 0;
+		}
+	}
+}
+
+void wavefront_integrator::compact()
+{
+	int n = 0;
+	for (int i = 0; i < n_paths; i++)
+	{
+		if (!alive[i])
+			continue;
+		if (n != i)
+		{
+			ox[n] = ox[i]; oy[n] = oy[i]; oz[n] = oz[i];
+			dx[n] = dx[i]; dy[n] = dy[i]; dz[n] = dz[i];
+			tr[n] = tr[i]; tg[n] = tg[i]; tb[n] = tb[i];
+			pixel[n] = pixel[i];
+			depth[n] = depth[i];
+			alive[n] = 1;
+		}
+		n++;
+	}
+	n_paths = n;
+}
@@ -0,0 +1,397 @@
+#pragma once
+#include "bvh.h"
+#include "simd.h"
+#include "ray_packet.h"
+#include "primitive_store.h"
+#include <stdint.h>
+#include <cassert>
+
+//Width of the wide BVH follows the instruction set the build targets:
+//	8 children with AVX2, 4 with SSE and 4 with the scalar fallback.
+const int WIDE_BVH_WIDTH = SIMD_WIDTH;
+
+//Every wide node on the way down leaves at most WIDE_BVH_WIDTH - 1 of its
+//	children on the stack, and a wide node is at least one binary level
+//	below its parent, so BVH_MAX_DEPTH bounds how many of them there are.
+const int WIDE_BVH_STACK_SIZE = 1 + (WIDE_BVH_WIDTH - 1) * BVH_MAX_DEPTH;
+
+//Child bounds are stored SoA so one slab test covers all children.
+//	bounds[0..2] hold min x/y/z and bounds[3..5] max x/y/z of every child.
+//	Unused slots have inverted (empty) bounds and never report a hit.
+struct alignas(32) wide_bvh_node
+{
+	float bounds[6][WIDE_BVH_WIDTH];
+	int child[WIDE_BVH_WIDTH]; //node index, or first primitive for leaves
+	int count[WIDE_BVH_WIDTH]; //0 -> interior child, > 0 -> leaf primitive count
+};
+
+//Ray data the slab test needs, set up once per ray. near[a] is the bounds row
+//	of the entry plane on axis a (min for positive directions, max otherwise),
+//	which is the swap in aabb::hitImproved done once instead of per box.
+struct wide_ray
+{
+	wide_ray(const ray& r)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			org[a] = r.origin()[a];
+			inv_dir[a] = r.InvDir()[a];
+			near[a] = inv_dir[a] < 0.0f ? a + 3 : a;
+			far[a] = inv_dir[a] < 0.0f ? a : a + 3;
+		}
+	}
+
+	float org[3];
+	float inv_dir[3];
+	int near[3];
+	int far[3];
+};
+
+//Slab test of the ray against all children of a node.
+//	Returns a bit mask of the children hit and their entry distances.
+inline int wide_bvh_intersect_children(const wide_bvh_node& node, const wide_ray& wr, float t_min, float t_max, float *t_near)
+{
+	vfloat tn = vset1(t_min);
+	vfloat tf = vset1(t_max);
+	for (int a = 0; a < 3; a++)
+	{
+		vfloat o = vset1(wr.org[a]);
+		vfloat id = vset1(wr.inv_dir[a]);
+		tn = vmax(vmul(vsub(vload(node.bounds[wr.near[a]]), o), id), tn);
+		tf = vmin(vmul(vsub(vload(node.bounds[wr.far[a]]), o), id), tf);
+	}
+	vstore(t_near, tn);
+	return vmovemask(vlt(tn, tf));
+}
+
+class wide_bvh : public hitable
+{
+public:
+	wide_bvh() {}
+	wide_bvh(hitable **l, int n, bvh_quality quality = BVH_MEDIUM, int max_prims_in_node = 4);
+	//Builds the tree again over the primitives already compiled, see below
+	void rebuild(bvh_quality quality = BVH_MEDIUM, int max_prims_in_node = 4);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	//Closest hit of every ray in the packet, see ray_packet.h
+	void hit_packet(ray_packet& p) const;
+	virtual bool bounding_box(aabb& box) const
+	{
+		box = root_bounds;
+		return true;
+	}
+
+	std::vector<wide_bvh_node> nodes;
+	primitive_store store; //what the hitables passed in compile to
+	std::vector<primitive_handle> primitives; //in leaf order, sorted by tag within a leaf
+	aabb root_bounds;
+	bool root_is_leaf;
+
+private:
+	void build(const std::vector<primitive_handle>& handles, bvh_quality quality, int max_prims_in_node);
+	int collapse(const bvh_build_node *node);
+};
+
+//The tree is built over the compiled primitives, so a box is split into
+//	its faces and each gets its own bounds.
+wide_bvh::wide_bvh(hitable **l, int n, bvh_quality quality, int max_prims_in_node)
+{
+	std::vector<primitive_handle> handles;
+	store.add(l, n, handles);
+	build(handles, quality, max_prims_in_node);
+}
+
+//For a top level over instances that moved (instance::place() on the
+//	instances passed to the constructor): they are copied again, their
+//	bounds gathered and the nodes replaced. Nothing is compiled and the
+//	geometry they place, with its own BVH, is untouched. The cost follows
+//	the number of instances, not their triangles: a few milliseconds for
+//	thousands of them.
+void wide_bvh::rebuild(bvh_quality quality, int max_prims_in_node)
+{
+	store.refresh();
+	std::vector<primitive_handle> handles(primitives);
+	build(handles, quality, max_prims_in_node);
+}
+
+void wide_bvh::build(const std::vector<primitive_handle>& handles, bvh_quality quality, int max_prims_in_node)
+{
+	int n = int(handles.size());
+	std::vector<bvh_primitive_info> info(n);
+	for (int i = 0; i < n; i++)
+		info[i] = bvh_primitive_info(i, store.bounds(handles[i]));
+
+	int total_nodes = 0;
+	std::vector<int> ordered;
+	bvh_build_node *root = bvh_build(info, max_prims_in_node, quality, total_nodes, ordered);
+
+	primitives.resize(n);
+	for (int i = 0; i < n; i++)
+		primitives[i] = handles[ordered[i]];
+	nodes.clear();
+
+	root_bounds = root->bounds;
+	root_is_leaf = root->n_primitives > 0;
+	if (!root_is_leaf)
+		collapse(root);
+	else
+		std::sort(primitives.begin(), primitives.end());
+	bvh_free_build_tree(root);
+}
+
+//Pulls the binary build tree up into nodes of WIDE_BVH_WIDTH children by
+//	repeatedly opening the interior child with the largest surface area.
+int wide_bvh::collapse(const bvh_build_node *node)
+{
+	const bvh_build_node *children[WIDE_BVH_WIDTH];
+	int n_children = 2;
+	children[0] = node->children[0];
+	children[1] = node->children[1];
+	while (n_children < WIDE_BVH_WIDTH)
+	{
+		int best = -1;
+		float best_area = -1.0f;
+		for (int i = 0; i < n_children; i++)
+		{
+			if (children[i]->n_primitives == 0 && children[i]->bounds.area() > best_area)
+			{
+				best = i;
+				best_area = children[i]->bounds.area();
+			}
+		}
+		if (best < 0)
+			break;
+		const bvh_build_node *opened = children[best];
+		children[best] = opened->children[0];
+		children[n_children++] = opened->children[1];
+	}
+
+	int index = int(nodes.size());
+	nodes.push_back(wide_bvh_node());
+	for (int i = 0; i < WIDE_BVH_WIDTH; i++)
+	{
+		wide_bvh_node& wn = nodes[index];
+		if (i < n_children)
+		{
+			const aabb& b = children[i]->bounds;
+			for (int a = 0; a < 3; a++)
+			{
+				wn.bounds[a][i] = b.min()[a];
+				wn.bounds[a + 3][i] = b.max()[a];
+			}
+		}
+		else
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				wn.bounds[a][i] = FLT_MAX;
+				wn.bounds[a + 3][i] = -FLT_MAX;
+			}
+		}
+		wn.child[i] = 0;
+		wn.count[i] = 0;
+	}
+
+	for (int i = 0; i < n_children; i++)
+	{
+		if (children[i]->n_primitives > 0)
+		{
+			int first = children[i]->first_prim_offset;
+			nodes[index].child[i] = first;
+			nodes[index].count[i] = children[i]->n_primitives;
+			//Same kinds next to each other, so the leaf loop's switch keeps branching the same way
+			std::sort(primitives.begin() + first, primitives.begin() + first + children[i]->n_primitives);
+		}
+		else
+		{
+			int c = collapse(children[i]);
+			nodes[index].child[i] = c;
+		}
+	}
+	return index;
+}
+
+bool wide_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	bool hit_anything = false;
+	float closest_so_far = t_max;
+
+	if (root_is_leaf)
+		return store.hit_range(primitives.data(), int(primitives.size()), r, t_min, closest_so_far, rec);
+
+	struct stack_entry
+	{
+		int child;
+		int count;
+		float t_near;
+	};
+	stack_entry stack[WIDE_BVH_STACK_SIZE];
+	int to_visit = 0;
+	stack[to_visit++] = { 0, 0, t_min };
+
+	wide_ray wr(r);
+	alignas(32) float t_near[WIDE_BVH_WIDTH];
+	while (to_visit > 0)
+	{
+		stack_entry e = stack[--to_visit];
+		if (e.t_near >= closest_so_far)
+			continue;
+
+		if (e.count > 0)
+		{
+			hit_anything |= store.hit_range(&primitives[e.child], e.count, r, t_min, closest_so_far, rec);
+			continue;
+		}
+
+		const wide_bvh_node& node = nodes[e.child];
+		int mask = wide_bvh_intersect_children(node, wr, t_min, closest_so_far, t_near);
+
+		//Push the hit children far to near so the nearest one is popped first
+		assert(to_visit + lane_count(mask) <= WIDE_BVH_STACK_SIZE);
+		int base = to_visit;
+		while (mask)
+		{
+			int i = first_set_lane(mask);
+			mask &= mask - 1;
+			stack_entry c = { node.child[i], node.count[i], t_near[i] };
+			int j = to_visit++;
+			while (j > base && stack[j - 1].t_near < c.t_near)
+			{
+				stack[j] = stack[j - 1];
+				j--;
+			}
+			stack[j] = c;
+		}
+	}
+	return hit_anything;
+}
+
+//Any-hit traversal: children are pushed in mask order without sorting,
+//	since the first hit anywhere ends the query.
+bool wide_bvh::occluded(const ray& r, float t_min, float t_max) const
+{
+	if (root_is_leaf)
+		return store.occluded_range(primitives.data(), int(primitives.size()), r, t_min, t_max);
+
+	struct stack_entry
+	{
+		int child;
+		int count;
+	};
+	stack_entry stack[WIDE_BVH_STACK_SIZE];
+	int to_visit = 0;
+	stack[to_visit++] = { 0, 0 };
+
+	wide_ray wr(r);
+	alignas(32) float t_near[WIDE_BVH_WIDTH];
+	while (to_visit > 0)
+	{
+		stack_entry e = stack[--to_visit];
+		if (e.count > 0)
+		{
+			if (store.occluded_range(&primitives[e.child], e.count, r, t_min, t_max))
+				return true;
+			continue;
+		}
+
+		const wide_bvh_node& node = nodes[e.child];
+		int mask = wide_bvh_intersect_children(node, wr, t_min, t_max, t_near);
+		assert(to_visit + lane_count(mask) <= WIDE_BVH_STACK_SIZE);
+		while (mask)
+		{
+			int i = first_set_lane(mask);
+			mask &= mask - 1;
+			stack[to_visit++] = { node.child[i], node.count[i] };
+		}
+	}
+	return false;
+}
+
+//Packet traversal: a node is culled for the whole packet by the interval
+//	frustum test first, and only the children that survive it are tested
+//	against the individual rays (SIMD across rays). Each stack entry keeps
+//	the mask of rays still active for it, so leaves only test those rays.
+void wide_bvh::hit_packet(ray_packet& p) const
+{
+	auto intersect_leaf = [&](int first, int count, int ray_mask)
+	{
+		while (ray_mask)
+		{
+			int r = first_set_lane(ray_mask);
+			ray_mask &= ray_mask - 1;
+			if (store.hit_range(&primitives[first], count, p.rays[r], p.t_min, p.t_max[r], p.recs[r]))
+				p.hit[r] = true;
+		}
+	};
+
+	int all_rays = (1 << p.n) - 1;
+	if (root_is_leaf)
+	{
+		intersect_leaf(0, int(primitives.size()), all_rays);
+		return;
+	}
+
+	struct stack_entry
+	{
+		int child;
+		int count;
+		int ray_mask;
+		float t_near;
+	};
+	stack_entry stack[WIDE_BVH_STACK_SIZE];
+	int to_visit = 0;
+	stack[to_visit++] = { 0, 0, all_rays, p.t_min };
+
+	alignas(32) float t_near[WIDE_BVH_WIDTH];
+	while (to_visit > 0)
+	{
+		stack_entry e = stack[--to_visit];
+		float packet_t_max = p.max_t();
+		if (e.t_near > packet_t_max)
+			continue;
+
+		if (e.count > 0)
+		{
+			intersect_leaf(e.child, e.count, e.ray_mask);
+			continue;
+		}
+
+		const wide_bvh_node& node = nodes[e.child];
+		int mask;
+		if (p.coherent)
+		{
+			mask = packet_frustum_mask(p, node.bounds, packet_t_max, t_near);
+		}
+		else
+		{
+			mask = (1 << WIDE_BVH_WIDTH) - 1;
+			for (int i = 0; i < WIDE_BVH_WIDTH; i++)
+				t_near[i] = p.t_min;
+		}
+
+		assert(to_visit + lane_count(mask) <= WIDE_BVH_STACK_SIZE);
+		int base = to_visit;
+		while (mask)
+		{
+			int i = first_set_lane(mask);
+			mask &= mask - 1;
+			if (node.bounds[0][i] > node.bounds[3][i])
+				continue; //unused slot
+			float bmin[3] = { node.bounds[0][i], node.bounds[1][i], node.bounds[2][i] };
+			float bmax[3] = { node.bounds[3][i], node.bounds[4][i], node.bounds[5][i] };
+			int ray_mask = p.box_mask(bmin, bmax) & e.ray_mask;
+			if (!ray_mask)
+				continue;
+
+			//Push far to near so the nearest child is popped first
+			stack_entry c = { node.child[i], node.count[i], ray_mask, t_near[i] };
+			int j = to_visit++;
+			while (j > base && stack[j - 1].t_near < c.t_near)
+			{
+				stack[j] = stack[j - 1];
+				j--;
+			}
+			stack[j] = c;
+		}
+	}
+}